@@ -78,6 +78,7 @@ my @core = qw(
     HeaderChecker
     Make
     OperatingSystem
+    ProbeProfile
     Util
 );
 
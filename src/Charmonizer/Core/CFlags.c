@@ -22,48 +22,50 @@
 #include "Charmonizer/Core/OperatingSystem.h"
 
 struct chaz_CFlags {
-    int   style;
-    char *string;
+    int       style;
+    int       hidden;  /* Set by chaz_CFlags_hide_symbols. */
+    chaz_Buf  string;
 };
 
+/* Test whether a program can be compiled and linked with [string] added to
+ * the flags.
+ */
+static int
+chaz_CFlags_test_flags(const char *string);
+
 chaz_CFlags*
 chaz_CFlags_new(int style) {
     chaz_CFlags *flags = (chaz_CFlags*)malloc(sizeof(chaz_CFlags));
     flags->style  = style;
-    flags->string = chaz_Util_strdup("");
+    flags->hidden = 0;
+    chaz_Buf_init(&flags->string);
+    chaz_Buf_append(&flags->string, "");
     return flags;
 }
 
 void
 chaz_CFlags_destroy(chaz_CFlags *flags) {
-    free(flags->string);
+    chaz_Buf_clear(&flags->string);
     free(flags);
 }
 
 const char*
 chaz_CFlags_get_string(chaz_CFlags *flags) {
-    return flags->string;
+    return flags->string.ptr;
 }
 
 void
 chaz_CFlags_append(chaz_CFlags *flags, const char *string) {
-    char *new_string;
-    if (flags->string[0] == '\0') {
-        new_string = chaz_Util_strdup(string);
+    if (flags->string.len != 0) {
+        chaz_Buf_append(&flags->string, " ");
     }
-    else {
-        new_string = chaz_Util_join(" ", flags->string, string, NULL);
-    }
-    free(flags->string);
-    flags->string = new_string;
+    chaz_Buf_append(&flags->string, string);
 }
 
 void
 chaz_CFlags_clear(chaz_CFlags *flags) {
-    if (flags->string[0] != '\0') {
-        free(flags->string);
-        flags->string = chaz_Util_strdup("");
-    }
+    flags->string.len    = 0;
+    flags->string.ptr[0] = '\0';
 }
 
 void
@@ -155,6 +157,20 @@ chaz_CFlags_enable_optimization(chaz_CFlags *flags) {
     chaz_CFlags_append(flags, string);
 }
 
+int
+chaz_CFlags_disable_optimization(chaz_CFlags *flags) {
+    if (flags->style == CHAZ_CFLAGS_STYLE_MSVC) {
+        chaz_CFlags_append(flags, "/Od");
+    }
+    else if (flags->style == CHAZ_CFLAGS_STYLE_GNU) {
+        chaz_CFlags_append(flags, "-O0");
+    }
+    else {
+        return 0;
+    }
+    return 1;
+}
+
 void
 chaz_CFlags_enable_debugging(chaz_CFlags *flags) {
     if (flags->style == CHAZ_CFLAGS_STYLE_GNU
@@ -232,6 +248,7 @@ chaz_CFlags_hide_symbols(chaz_CFlags *flags) {
     if (flags->style == CHAZ_CFLAGS_STYLE_GNU) {
         if (chaz_CC_binary_format() != CHAZ_CC_BINFMT_PE) {
             chaz_CFlags_append(flags, "-fvisibility=hidden");
+            flags->hidden = 1;
         }
     }
     else if (flags->style == CHAZ_CFLAGS_STYLE_SUN_C) {
@@ -246,10 +263,16 @@ chaz_CFlags_hide_symbols(chaz_CFlags *flags) {
 
         if (version_ge_550) {
             chaz_CFlags_append(flags, "-xldscope=hidden");
+            flags->hidden = 1;
         }
     }
 }
 
+int
+chaz_CFlags_symbols_hidden(chaz_CFlags *flags) {
+    return flags->hidden;
+}
+
 void
 chaz_CFlags_link_shared_library(chaz_CFlags *flags, const char *basename,
                                 const char *version,
@@ -396,4 +419,271 @@ chaz_CFlags_enable_code_coverage(chaz_CFlags *flags) {
     }
 }
 
+int
+chaz_CFlags_generate_dep_files(chaz_CFlags *flags) {
+    if (flags->style == CHAZ_CFLAGS_STYLE_GNU) {
+        /* -MP adds phony targets for headers, so deleting a header
+         * doesn't break the build. */
+        chaz_CFlags_append(flags, "-MMD -MP");
+        return 1;
+    }
+    return 0;
+}
+
+static int
+chaz_CFlags_test_flags(const char *string) {
+    static const char code[] =
+        CHAZ_QUOTE(  int main() { return 0; }  );
+    chaz_CFlags *temp_cflags = chaz_CC_get_temp_cflags();
+    int succeeded;
+
+    chaz_CFlags_append(temp_cflags, string);
+    succeeded = chaz_CC_test_link(code);
+    chaz_CFlags_clear(temp_cflags);
 
+    return succeeded;
+}
+
+int
+chaz_CFlags_enable_lto(chaz_CFlags *flags, int mode) {
+    const char *string = NULL;
+
+    if (flags->style == CHAZ_CFLAGS_STYLE_MSVC) {
+        string = "/GL";
+    }
+    else if (flags->style == CHAZ_CFLAGS_STYLE_GNU) {
+        if (mode == CHAZ_CFLAGS_LTO_THIN && chaz_CC_is_clang()
+            && chaz_CFlags_test_flags("-flto=thin")
+           ) {
+            string = "-flto=thin";
+        }
+        else if (chaz_CFlags_test_flags("-flto")) {
+            string = "-flto";
+        }
+    }
+
+    if (string == NULL) { return 0; }
+
+    chaz_CFlags_append(flags, string);
+    return 1;
+}
+
+int
+chaz_CFlags_link_lto(chaz_CFlags *flags, int mode) {
+    const char *string = NULL;
+
+    if (flags->style == CHAZ_CFLAGS_STYLE_MSVC) {
+        string = "/LTCG";
+    }
+    else if (flags->style == CHAZ_CFLAGS_STYLE_GNU) {
+        if (chaz_CC_is_clang()) {
+            if (mode == CHAZ_CFLAGS_LTO_THIN
+                && chaz_CFlags_test_flags("-flto=thin")
+               ) {
+                string = "-flto=thin";
+            }
+            else if (chaz_CFlags_test_flags("-flto")) {
+                string = "-flto";
+            }
+        }
+        /* -flto=auto uses the jobserver of GNU make or the number of
+         * CPUs. Older GCCs only support -flto=jobserver. */
+        else if (chaz_CFlags_test_flags("-flto=auto")) {
+            string = "-flto=auto";
+        }
+        else if (chaz_CFlags_test_flags("-flto=jobserver")) {
+            string = "-flto=jobserver";
+        }
+        else if (chaz_CFlags_test_flags("-flto")) {
+            string = "-flto";
+        }
+    }
+
+    if (string == NULL) { return 0; }
+
+    chaz_CFlags_append(flags, string);
+    return 1;
+}
+
+
+int
+chaz_CFlags_split_debug_info(chaz_CFlags *flags) {
+    static int supported = -1;
+
+    if (flags->style != CHAZ_CFLAGS_STYLE_GNU
+        || chaz_CC_binary_format() != CHAZ_CC_BINFMT_ELF
+       ) {
+        return 0;
+    }
+    if (supported < 0) {
+        supported = chaz_CFlags_test_flags("-g -gsplit-dwarf");
+    }
+    if (!supported) { return 0; }
+
+    chaz_CFlags_append(flags, "-gsplit-dwarf");
+    return 1;
+}
+
+int
+chaz_CFlags_use_fast_linker(chaz_CFlags *flags) {
+    static const char *const linkers[] = {
+        "-fuse-ld=mold", "-fuse-ld=lld", "-fuse-ld=gold", NULL
+    };
+    static const char *selected = NULL;
+    static int checked = 0;
+
+    if (flags->style != CHAZ_CFLAGS_STYLE_GNU
+        || chaz_CC_binary_format() != CHAZ_CC_BINFMT_ELF
+       ) {
+        return 0;
+    }
+
+    if (!checked) {
+        int i;
+
+        for (i = 0; linkers[i]; i++) {
+            if (strcmp(linkers[i], "-fuse-ld=lld") == 0
+                && !chaz_CC_is_clang()
+               ) {
+                continue;
+            }
+            if (chaz_CFlags_test_flags(linkers[i])) {
+                selected = linkers[i];
+                break;
+            }
+        }
+        checked = 1;
+    }
+    if (selected == NULL) { return 0; }
+
+    chaz_CFlags_append(flags, selected);
+    return 1;
+}
+
+int
+chaz_CFlags_enable_section_gc(chaz_CFlags *flags) {
+    static int supported = -1;
+
+    if (flags->style == CHAZ_CFLAGS_STYLE_MSVC) {
+        chaz_CFlags_append(flags, "/Gy /Gw");
+        return 1;
+    }
+    if (flags->style != CHAZ_CFLAGS_STYLE_GNU) { return 0; }
+
+    if (supported < 0) {
+        supported
+            = chaz_CFlags_test_flags("-ffunction-sections -fdata-sections");
+    }
+    if (!supported) { return 0; }
+
+    chaz_CFlags_append(flags, "-ffunction-sections -fdata-sections");
+    return 1;
+}
+
+int
+chaz_CFlags_link_section_gc(chaz_CFlags *flags) {
+    static int supported = -1;
+    const char *string;
+
+    if (flags->style == CHAZ_CFLAGS_STYLE_MSVC) {
+        /* Needed because /DEBUG turns the default /OPT:REF off. */
+        chaz_CFlags_append(flags, "/OPT:REF");
+        return 1;
+    }
+    if (flags->style != CHAZ_CFLAGS_STYLE_GNU) { return 0; }
+
+    switch (chaz_CC_binary_format()) {
+        case CHAZ_CC_BINFMT_ELF:   string = "-Wl,--gc-sections"; break;
+        case CHAZ_CC_BINFMT_MACHO: string = "-Wl,-dead_strip";   break;
+        default:                   return 0;
+    }
+    if (supported < 0) {
+        supported = chaz_CFlags_test_flags(string);
+    }
+    if (!supported) { return 0; }
+
+    chaz_CFlags_append(flags, string);
+    return 1;
+}
+
+int
+chaz_CFlags_optimize_dynamic_loading(chaz_CFlags *flags) {
+    /* Eager binding with -z now isn't used. It resolves every symbol at
+     * startup which is slower for short-lived processes. */
+    static const char *const candidates[] = {
+        "-Wl,-O1", "-Wl,--hash-style=gnu", "-Wl,--as-needed", NULL
+    };
+    static int supported[3];
+    static int checked = 0;
+    int added = 0;
+    int i;
+
+    if (flags->style != CHAZ_CFLAGS_STYLE_GNU
+        || chaz_CC_binary_format() != CHAZ_CC_BINFMT_ELF
+       ) {
+        return 0;
+    }
+
+    for (i = 0; candidates[i]; i++) {
+        if (!checked) {
+            supported[i] = chaz_CFlags_test_flags(candidates[i]);
+        }
+        if (supported[i]) {
+            chaz_CFlags_append(flags, candidates[i]);
+            added = 1;
+        }
+    }
+    checked = 1;
+
+    return added;
+}
+
+int
+chaz_CFlags_disable_semantic_interposition(chaz_CFlags *flags) {
+    static int supported = -1;
+
+    if (flags->style != CHAZ_CFLAGS_STYLE_GNU
+        || chaz_CC_binary_format() != CHAZ_CC_BINFMT_ELF
+       ) {
+        return 0;
+    }
+    if (supported < 0) {
+        supported = chaz_CFlags_test_flags("-fno-semantic-interposition");
+    }
+    if (!supported) { return 0; }
+
+    chaz_CFlags_append(flags, "-fno-semantic-interposition");
+    return 1;
+}
+
+int
+chaz_CFlags_link_symbolic_functions(chaz_CFlags *flags) {
+    static int supported = -1;
+
+    if (flags->style != CHAZ_CFLAGS_STYLE_GNU
+        || chaz_CC_binary_format() != CHAZ_CC_BINFMT_ELF
+       ) {
+        return 0;
+    }
+    if (supported < 0) {
+        supported = chaz_CFlags_test_flags("-shared -Wl,-Bsymbolic-functions");
+    }
+    if (!supported) { return 0; }
+
+    chaz_CFlags_append(flags, "-Wl,-Bsymbolic-functions");
+    return 1;
+}
+
+int
+chaz_CFlags_keep_frame_pointers(chaz_CFlags *flags) {
+    if (flags->style == CHAZ_CFLAGS_STYLE_GNU) {
+        chaz_CFlags_append(flags, "-fno-omit-frame-pointer");
+    }
+    else if (flags->style == CHAZ_CFLAGS_STYLE_MSVC) {
+        chaz_CFlags_append(flags, "/Oy-");
+    }
+    else {
+        return 0;
+    }
+    return 1;
+}
@@ -29,6 +29,9 @@ extern "C" {
 #define CHAZ_CFLAGS_STYLE_MSVC   3
 #define CHAZ_CFLAGS_STYLE_SUN_C  4
 
+#define CHAZ_CFLAGS_LTO_FULL  1
+#define CHAZ_CFLAGS_LTO_THIN  2
+
 typedef struct chaz_CFlags chaz_CFlags;
 
 chaz_CFlags*
@@ -62,6 +65,16 @@ chaz_CFlags_add_include_dir(chaz_CFlags *flags, const char *dir);
 void
 chaz_CFlags_enable_optimization(chaz_CFlags *flags);
 
+/* Add a flag that turns off optimization. Since the last optimization flag
+ * wins, this overrides an optimization level from earlier flags. Returns
+ * false if the compiler has no such flag.
+ */
+int
+chaz_CFlags_disable_optimization(chaz_CFlags *flags);
+
+void
+chaz_CFlags_enable_debugging(chaz_CFlags *flags);
+
 void
 chaz_CFlags_disable_strict_aliasing(chaz_CFlags *flags);
 
@@ -74,6 +87,11 @@ chaz_CFlags_compile_shared_library(chaz_CFlags *flags);
 void
 chaz_CFlags_hide_symbols(chaz_CFlags *flags);
 
+/* Return true if chaz_CFlags_hide_symbols added flags.
+ */
+int
+chaz_CFlags_symbols_hidden(chaz_CFlags *flags);
+
 void
 chaz_CFlags_link_shared_library(chaz_CFlags *flags, const char *basename,
                                 const char *version,
@@ -98,6 +116,84 @@ chaz_CFlags_add_rpath(chaz_CFlags *flags, const char *path);
 void
 chaz_CFlags_enable_code_coverage(chaz_CFlags *flags);
 
+/* Make the compiler write a dependency file next to each object file.
+ * Returns false if the compiler doesn't support this.
+ */
+int
+chaz_CFlags_generate_dep_files(chaz_CFlags *flags);
+
+/* Add compiler flags for link-time optimization. [mode] is one of the
+ * CHAZ_CFLAGS_LTO constants. Thin LTO falls back to full LTO if it isn't
+ * supported. Returns false and doesn't change the flags if the toolchain
+ * can't link objects compiled with LTO.
+ */
+int
+chaz_CFlags_enable_lto(chaz_CFlags *flags, int mode);
+
+/* Add linker flags for link-time optimization. With GCC, the LTO stage
+ * runs in parallel, using the make jobserver if available. Returns false
+ * if the toolchain doesn't support LTO.
+ */
+int
+chaz_CFlags_link_lto(chaz_CFlags *flags, int mode);
+
+/* Add compiler flags to write DWARF debugging information to .dwo files
+ * next to the objects instead of the objects themselves, so the linker
+ * has less to process. Should be combined with
+ * chaz_CFlags_enable_debugging. Returns false if unsupported.
+ */
+int
+chaz_CFlags_split_debug_info(chaz_CFlags *flags);
+
+/* Add linker flags to link with the fastest available linker out of mold,
+ * lld and gold. lld is skipped with GCC whose LTO objects it can't read.
+ * Returns false if none of them works.
+ */
+int
+chaz_CFlags_use_fast_linker(chaz_CFlags *flags);
+
+/* Add compiler flags to place every function and data item in its own
+ * section so that unused ones can be removed by the linker. Returns false
+ * if unsupported.
+ */
+int
+chaz_CFlags_enable_section_gc(chaz_CFlags *flags);
+
+/* Add linker flags to remove unused sections. Returns false if
+ * unsupported.
+ */
+int
+chaz_CFlags_link_section_gc(chaz_CFlags *flags);
+
+/* Add ELF linker flags that make binaries faster to load: -O1 for
+ * optimized symbol hash tables, GNU-style hash tables and --as-needed to
+ * drop dependencies on unused libraries. Must be added before libraries.
+ * Returns false if none is supported.
+ */
+int
+chaz_CFlags_optimize_dynamic_loading(chaz_CFlags *flags);
+
+/* Add compiler flags that let the compiler assume that exported functions
+ * of a shared library aren't interposed, so calls within the library can
+ * be inlined or bypass the PLT. Returns false if unsupported.
+ */
+int
+chaz_CFlags_disable_semantic_interposition(chaz_CFlags *flags);
+
+/* Add linker flags to bind calls to functions within a shared library
+ * locally instead of through the dynamic linker. Returns false if
+ * unsupported.
+ */
+int
+chaz_CFlags_link_symbolic_functions(chaz_CFlags *flags);
+
+/* Add compiler flags that keep frame pointers in optimized code, so
+ * sampling profilers can walk the stack cheaply. Returns false if
+ * unsupported.
+ */
+int
+chaz_CFlags_keep_frame_pointers(chaz_CFlags *flags);
+
 #ifdef __cplusplus
 }
 #endif
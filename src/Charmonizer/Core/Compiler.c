@@ -21,17 +21,47 @@
 #include "Charmonizer/Core/Compiler.h"
 #include "Charmonizer/Core/ConfWriter.h"
 #include "Charmonizer/Core/OperatingSystem.h"
+#include "Charmonizer/Core/ProbeProfile.h"
 
-/* Detect binary format.
+/* Detect binary format from the contents of an executable.
  */
 static void
-chaz_CC_detect_binary_format(const char *filename);
+chaz_CC_detect_binary_format(const char *exe, size_t exe_len);
 
 /* Detect macros which may help to identify some compilers.
  */
 static void
 chaz_CC_detect_known_compilers(void);
 
+/* Try to compile the identification program with a given argument style.
+ */
+static int
+chaz_CC_try_cflags_style(int cflags_style);
+
+/* Look for the identification string in the contents of the test
+ * executable. Return true if it was found.
+ */
+static int
+chaz_CC_parse_identification(const char *exe, size_t exe_len);
+
+/* Return the name of the LTO-aware variant of a binutils tool like "ar" if
+ * [lto_tools] is true and it can be found. Otherwise, return the plain
+ * name.
+ */
+static char*
+chaz_CC_tool_name(const char *tool, int lto_tools);
+
+/* Create an archiver command, optionally with LTO-aware tools.
+ */
+static char*
+chaz_CC_archiver_command(const char *target, const char *objects,
+                         int lto_tools);
+
+/* Create a ranlib command, optionally with LTO-aware tools.
+ */
+static char*
+chaz_CC_ranlib_command(const char *target, int lto_tools);
+
 /** Build a library filename from its components.
  */
 static char*
@@ -39,6 +69,37 @@ chaz_CC_build_lib_filename(const char *dir, const char *prefix,
                            const char *basename, const char *version,
                            const char *ext);
 
+/* Identification program compiled by chaz_CC_init. The string embedded in
+ * the executable tells us about the compiler without further test
+ * compiles.
+ */
+#define CHAZ_CC_ID_MARKER "chzCcId:"
+static const char chaz_CC_id_code[] =
+    CHAZ_QUOTE(  static const char chaz_cc_id[] = "chzCcId:"     )
+    CHAZ_QUOTE(  #ifdef __GNUC__                                 )
+    CHAZ_QUOTE(      "gcc:"                                      )
+    CHAZ_QUOTE(  #endif                                          )
+    CHAZ_QUOTE(  #ifdef _MSC_VER                                 )
+    CHAZ_QUOTE(      "msvc:"                                     )
+    CHAZ_QUOTE(  #endif                                          )
+    CHAZ_QUOTE(  #ifdef __clang__                                )
+    CHAZ_QUOTE(      "clang:"                                    )
+    CHAZ_QUOTE(  #endif                                          )
+    CHAZ_QUOTE(  #ifdef __SUNPRO_C                               )
+    CHAZ_QUOTE(      "sunc:"                                     )
+    CHAZ_QUOTE(  #endif                                          )
+    CHAZ_QUOTE(  #ifdef __CYGWIN__                               )
+    CHAZ_QUOTE(      "cygwin:"                                   )
+    CHAZ_QUOTE(  #endif                                          )
+    CHAZ_QUOTE(  #ifdef __MINGW32__                              )
+    CHAZ_QUOTE(      "mingw:"                                    )
+    CHAZ_QUOTE(  #endif                                          )
+    CHAZ_QUOTE(      ".";                                        )
+    CHAZ_QUOTE(  int main(int argc, char **argv) {               )
+    CHAZ_QUOTE(      (void)argv;                                 )
+    CHAZ_QUOTE(      return chaz_cc_id[argc] == 0;               )
+    CHAZ_QUOTE(  }                                               );
+
 /* Temporary files. */
 #define CHAZ_CC_TRY_SOURCE_PATH  "_charmonizer_try.c"
 #define CHAZ_CC_TRY_BASENAME     "_charmonizer_try"
@@ -74,8 +135,10 @@ static struct {
 
 void
 chaz_CC_init(const char *compiler_command, const char *compiler_flags) {
-    const char *code = "int main() { return 0; }\n";
     int compile_succeeded = 0;
+    int identified = 0;
+    char *exe;
+    size_t exe_len;
 
     if (chaz_Util_verbosity) { printf("Creating compiler object...\n"); }
 
@@ -95,39 +158,31 @@ chaz_CC_init(const char *compiler_command, const char *compiler_flags) {
         printf("Trying to compile and execute a small test file...\n");
     }
 
-    /* Try MSVC argument style. */
-    if (!compile_succeeded) {
-        chaz_CC.cflags_style = CHAZ_CFLAGS_STYLE_MSVC;
-        if (!chaz_Util_remove_and_verify(chaz_CC.try_exe_name)) {
-            chaz_Util_die("Failed to delete file '%s'", chaz_CC.try_exe_name);
-        }
-        compile_succeeded = chaz_CC_compile_exe(CHAZ_CC_TRY_SOURCE_PATH,
-                                                CHAZ_CC_TRY_BASENAME, code);
-        if (compile_succeeded) {
-            strcpy(chaz_CC.obj_ext, ".obj");
-        }
-    }
-
-    /* Try POSIX argument style. */
-    if (!compile_succeeded) {
-        chaz_CC.cflags_style = CHAZ_CFLAGS_STYLE_POSIX;
-        if (!chaz_Util_remove_and_verify(chaz_CC.try_exe_name)) {
-            chaz_Util_die("Failed to delete file '%s'", chaz_CC.try_exe_name);
-        }
-        compile_succeeded = chaz_CC_compile_exe(CHAZ_CC_TRY_SOURCE_PATH,
-                                                CHAZ_CC_TRY_BASENAME, code);
-        if (compile_succeeded) {
-            strcpy(chaz_CC.obj_ext, ".o");
-        }
-    }
+    /* Try the argument style native to the host first. */
+#ifdef _WIN32
+    compile_succeeded = chaz_CC_try_cflags_style(CHAZ_CFLAGS_STYLE_MSVC)
+                        || chaz_CC_try_cflags_style(CHAZ_CFLAGS_STYLE_POSIX);
+#else
+    compile_succeeded = chaz_CC_try_cflags_style(CHAZ_CFLAGS_STYLE_POSIX)
+                        || chaz_CC_try_cflags_style(CHAZ_CFLAGS_STYLE_MSVC);
+#endif
 
     if (!compile_succeeded) {
         chaz_Util_die("Failed to compile a small test file");
     }
-    chaz_CC_detect_binary_format(chaz_CC.try_exe_name);
+    exe = chaz_Util_slurp_file(chaz_CC.try_exe_name, &exe_len);
+    chaz_CC_detect_binary_format(exe, exe_len);
+    if (exe != NULL) {
+        identified = chaz_CC_parse_identification(exe, exe_len);
+        free(exe);
+    }
     chaz_Util_remove_and_verify(chaz_CC.try_exe_name);
 
-    chaz_CC_detect_known_compilers();
+    /* Fall back to test compiles if the identification string couldn't be
+     * found. */
+    if (!identified) {
+        chaz_CC_detect_known_compilers();
+    }
 
     if (chaz_CC_is_gcc()) {
         chaz_CC.cflags_style = CHAZ_CFLAGS_STYLE_GNU;
@@ -180,11 +235,9 @@ chaz_CC_init(const char *compiler_command, const char *compiler_flags) {
             strcpy(chaz_CC.obj_ext, ".obj");
         }
 
-        if (chaz_CC_has_macro("__CYGWIN__")) {
-            chaz_CC.is_cygwin = 1;
-        }
-        if (chaz_CC_has_macro("__MINGW32__")) {
-            chaz_CC.is_mingw = 1;
+        if (!identified) {
+            chaz_CC.is_cygwin = chaz_CC_has_macro("__CYGWIN__");
+            chaz_CC.is_mingw  = chaz_CC_has_macro("__MINGW32__");
         }
     }
     else {
@@ -196,14 +249,91 @@ chaz_CC_init(const char *compiler_command, const char *compiler_flags) {
         = chaz_Util_join("", CHAZ_CC_TRY_BASENAME, chaz_CC.exe_ext, NULL);
 }
 
+static int
+chaz_CC_try_cflags_style(int cflags_style) {
+    chaz_CC.cflags_style = cflags_style;
+    if (!chaz_Util_remove_and_verify(chaz_CC.try_exe_name)) {
+        chaz_Util_die("Failed to delete file '%s'", chaz_CC.try_exe_name);
+    }
+    if (!chaz_CC_compile_exe(CHAZ_CC_TRY_SOURCE_PATH, CHAZ_CC_TRY_BASENAME,
+                             chaz_CC_id_code)
+       ) {
+        return 0;
+    }
+    if (cflags_style == CHAZ_CFLAGS_STYLE_MSVC) {
+        strcpy(chaz_CC.obj_ext, ".obj");
+    }
+    else {
+        strcpy(chaz_CC.obj_ext, ".o");
+    }
+    return 1;
+}
+
+static int
+chaz_CC_parse_identification(const char *exe, size_t exe_len) {
+    const size_t marker_len = sizeof(CHAZ_CC_ID_MARKER) - 1;
+    const char *id = NULL;
+    const char *end;
+    size_t i;
+
+    for (i = 0; i + marker_len <= exe_len; i++) {
+        if (exe[i] == 'c'
+            && memcmp(exe + i, CHAZ_CC_ID_MARKER, marker_len) == 0
+           ) {
+            id = exe + i + marker_len;
+            break;
+        }
+    }
+    if (id == NULL) { return 0; }
+
+    /* The identification string is a list of colon-terminated names,
+     * followed by a period. */
+    end = id;
+    while (end < exe + exe_len && *end != '.' && *end != '\0') { end++; }
+    if (end == exe + exe_len || *end != '.') { return 0; }
+
+    chaz_CC.is_gcc    = 0;
+    chaz_CC.is_msvc   = 0;
+    chaz_CC.is_clang  = 0;
+    chaz_CC.is_sun_c  = 0;
+    chaz_CC.is_cygwin = 0;
+    chaz_CC.is_mingw  = 0;
+    while (id < end) {
+        const char *colon = id;
+        size_t len;
+        while (colon < end && *colon != ':') { colon++; }
+        len = colon - id;
+        if (len == 3 && memcmp(id, "gcc", 3) == 0) {
+            chaz_CC.is_gcc = 1;
+        }
+        else if (len == 4 && memcmp(id, "msvc", 4) == 0) {
+            chaz_CC.is_msvc = 1;
+        }
+        else if (len == 5 && memcmp(id, "clang", 5) == 0) {
+            chaz_CC.is_clang = 1;
+        }
+        else if (len == 4 && memcmp(id, "sunc", 4) == 0) {
+            chaz_CC.is_sun_c = 1;
+        }
+        else if (len == 6 && memcmp(id, "cygwin", 6) == 0) {
+            chaz_CC.is_cygwin = 1;
+        }
+        else if (len == 5 && memcmp(id, "mingw", 5) == 0) {
+            chaz_CC.is_mingw = 1;
+        }
+        id = colon + 1;
+    }
+
+    if (chaz_Util_verbosity) {
+        printf("Identified compiler from test executable\n");
+    }
+    return 1;
+}
+
 static void
-chaz_CC_detect_binary_format(const char *filename) {
-    char *output;
-    size_t output_len;
+chaz_CC_detect_binary_format(const char *output, size_t output_len) {
     int binary_format = 0;
 
-    output = chaz_Util_slurp_file(filename, &output_len);
-
     /* ELF. */
     if (binary_format == 0 && output_len >= 4
         && memcmp(output, "\x7F" "ELF", 4) == 0
@@ -240,7 +370,6 @@ chaz_CC_detect_binary_format(const char *filename) {
     }
 
     chaz_CC.binary_format = binary_format;
-    free(output);
 }
 
 int
@@ -407,7 +536,13 @@ chaz_CC_compile_obj(const char *source_path, const char *obj_name,
 int
 chaz_CC_test_compile(const char *source) {
     int compile_succeeded;
-    char *try_obj_name
+    char *try_obj_name;
+    if (chaz_ProbeProfile_lookup(CHAZ_PROBEPROFILE_COMPILE, source,
+                                 &compile_succeeded, NULL, NULL)
+       ) {
+        return compile_succeeded;
+    }
+    try_obj_name
         = chaz_Util_join("", CHAZ_CC_TRY_BASENAME, chaz_CC.obj_ext, NULL);
     if (!chaz_Util_remove_and_verify(try_obj_name)) {
         chaz_Util_die("Failed to delete file '%s'", try_obj_name);
@@ -416,18 +551,27 @@ chaz_CC_test_compile(const char *source) {
                                             CHAZ_CC_TRY_BASENAME, source);
     chaz_Util_remove_and_verify(try_obj_name);
     free(try_obj_name);
+    chaz_ProbeProfile_record(CHAZ_PROBEPROFILE_COMPILE, source,
+                             compile_succeeded, NULL, 0);
     return compile_succeeded;
 }
 
 int
 chaz_CC_test_link(const char *source) {
     int link_succeeded;
+    if (chaz_ProbeProfile_lookup(CHAZ_PROBEPROFILE_LINK, source,
+                                 &link_succeeded, NULL, NULL)
+       ) {
+        return link_succeeded;
+    }
     if (!chaz_Util_remove_and_verify(chaz_CC.try_exe_name)) {
         chaz_Util_die("Failed to delete file '%s'", chaz_CC.try_exe_name);
     }
     link_succeeded = chaz_CC_compile_exe(CHAZ_CC_TRY_SOURCE_PATH,
                                          CHAZ_CC_TRY_BASENAME, source);
     chaz_Util_remove_and_verify(chaz_CC.try_exe_name);
+    chaz_ProbeProfile_record(CHAZ_PROBEPROFILE_LINK, source, link_succeeded,
+                             NULL, 0);
     return link_succeeded;
 }
 
@@ -436,6 +580,13 @@ chaz_CC_capture_output(const char *source, size_t *output_len) {
     char *captured_output = NULL;
     int compile_succeeded;
 
+    if (chaz_ProbeProfile_lookup(CHAZ_PROBEPROFILE_RUN, source,
+                                 &compile_succeeded, &captured_output,
+                                 output_len)
+       ) {
+        return captured_output;
+    }
+
     /* Clear out previous versions and test to make sure removal worked. */
     if (!chaz_Util_remove_and_verify(chaz_CC.try_exe_name)) {
         chaz_Util_die("Failed to delete file '%s'", chaz_CC.try_exe_name);
@@ -448,10 +599,16 @@ chaz_CC_capture_output(const char *source, size_t *output_len) {
     compile_succeeded = chaz_CC_compile_exe(CHAZ_CC_TRY_SOURCE_PATH,
                                             CHAZ_CC_TRY_BASENAME, source);
     if (compile_succeeded) {
-        chaz_OS_run_local_redirected(chaz_CC.try_exe_name,
-                                     CHAZ_CC_TARGET_PATH);
-        captured_output = chaz_Util_slurp_file(CHAZ_CC_TARGET_PATH,
-                                               output_len);
+        int status = chaz_OS_run_local_redirected(chaz_CC.try_exe_name,
+                                                  CHAZ_CC_TARGET_PATH);
+        if (status == CHAZ_OS_TIMED_OUT || status == -1) {
+            /* Treat output of killed or lost probes as missing. */
+            *output_len = 0;
+        }
+        else {
+            captured_output = chaz_Util_slurp_file(CHAZ_CC_TARGET_PATH,
+                                                   output_len);
+        }
     }
     else {
         *output_len = 0;
@@ -462,9 +619,47 @@ chaz_CC_capture_output(const char *source, size_t *output_len) {
     chaz_Util_remove_and_verify(chaz_CC.try_exe_name);
     chaz_Util_remove_and_verify(CHAZ_CC_TARGET_PATH);
 
+    chaz_ProbeProfile_record(CHAZ_PROBEPROFILE_RUN, source,
+                             captured_output != NULL, captured_output,
+                             *output_len);
     return captured_output;
 }
 
+char*
+chaz_CC_capture_obj(const char *source, size_t *obj_len) {
+    char *captured_obj = NULL;
+    char *try_obj_name;
+    int   found;
+
+    if (chaz_ProbeProfile_lookup(CHAZ_PROBEPROFILE_OBJ, source, &found,
+                                 &captured_obj, obj_len)
+       ) {
+        return captured_obj;
+    }
+
+    try_obj_name
+        = chaz_Util_join("", CHAZ_CC_TRY_BASENAME, chaz_CC.obj_ext, NULL);
+    if (!chaz_Util_remove_and_verify(try_obj_name)) {
+        chaz_Util_die("Failed to delete file '%s'", try_obj_name);
+    }
+
+    /* Attempt compilation; if successful, slurp object file. */
+    if (chaz_CC_compile_obj(CHAZ_CC_TRY_SOURCE_PATH, CHAZ_CC_TRY_BASENAME,
+                            source)
+       ) {
+        captured_obj = chaz_Util_slurp_file(try_obj_name, obj_len);
+    }
+    else {
+        *obj_len = 0;
+    }
+
+    chaz_Util_remove_and_verify(try_obj_name);
+    free(try_obj_name);
+    chaz_ProbeProfile_record(CHAZ_PROBEPROFILE_OBJ, source,
+                             captured_obj != NULL, captured_obj, *obj_len);
+    return captured_obj;
+}
+
 const char*
 chaz_CC_get_cc(void) {
     return chaz_CC.cc_command;
@@ -530,6 +725,11 @@ chaz_CC_is_msvc(void) {
     return chaz_CC.is_msvc;
 }
 
+int
+chaz_CC_is_clang(void) {
+    return chaz_CC.is_clang;
+}
+
 int
 chaz_CC_is_sun_c(void) {
     return chaz_CC.is_sun_c;
@@ -574,9 +774,21 @@ chaz_CC_link_command() {
 
 char*
 chaz_CC_format_archiver_command(const char *target, const char *objects) {
+    return chaz_CC_archiver_command(target, objects, 0);
+}
+
+char*
+chaz_CC_format_lto_archiver_command(const char *target,
+                                    const char *objects) {
+    return chaz_CC_archiver_command(target, objects, 1);
+}
+
+static char*
+chaz_CC_archiver_command(const char *target, const char *objects,
+                         int lto_tools) {
     if (chaz_CC_is_msvc()) {
-        /* TODO: Write `objects` to a temporary file in order to avoid
-         * exceeding line length limits. */
+        /* Long lists of objects can be passed in a response file with
+         * '@file' which is done by chaz_MakeBinary. */
         char *out = chaz_Util_join("", "/OUT:", target, NULL);
         char *command = chaz_Util_join(" ", "lib", "/NOLOGO", objects, out,
                                        NULL);
@@ -584,16 +796,79 @@ chaz_CC_format_archiver_command(const char *target, const char *objects) {
         return command;
     }
     else {
-        return chaz_Util_join(" ", "ar", "rcs", target, objects, NULL);
+        char *ar = chaz_CC_tool_name("ar", lto_tools);
+        char *command = chaz_Util_join(" ", ar, "rcs", target, objects,
+                                       NULL);
+        free(ar);
+        return command;
+    }
+}
+
+char*
+chaz_CC_format_thin_archiver_command(const char *target,
+                                     const char *objects, int lto_tools) {
+    char *ar;
+    char *command;
+
+    /* Thin archives are supported by GNU ar and llvm-ar, but not by the
+     * archivers of MSVC and Darwin. */
+    if (chaz_CC_is_msvc() || chaz_CC.binary_format != CHAZ_CC_BINFMT_ELF) {
+        return NULL;
     }
+    ar = chaz_CC_tool_name("ar", lto_tools);
+    command = chaz_Util_join(" ", ar, "rcsT", target, objects, NULL);
+    free(ar);
+    return command;
 }
 
 char*
 chaz_CC_format_ranlib_command(const char *target) {
+    return chaz_CC_ranlib_command(target, 0);
+}
+
+char*
+chaz_CC_format_lto_ranlib_command(const char *target) {
+    return chaz_CC_ranlib_command(target, 1);
+}
+
+static char*
+chaz_CC_ranlib_command(const char *target, int lto_tools) {
+    char *ranlib;
+    char *command;
     if (chaz_CC_is_msvc()) {
         return NULL;
     }
-    return chaz_Util_join(" ", "ranlib", target, NULL);
+    ranlib = chaz_CC_tool_name("ranlib", lto_tools);
+    command = chaz_Util_join(" ", ranlib, target, NULL);
+    free(ranlib);
+    return command;
+}
+
+static char*
+chaz_CC_tool_name(const char *tool, int lto_tools) {
+    if (lto_tools) {
+        const char *prefix = NULL;
+        char *name;
+        char *path;
+
+        if (chaz_CC_is_clang()) {
+            prefix = "llvm-";
+        }
+        else if (chaz_CC_is_gcc()) {
+            prefix = "gcc-";
+        }
+        if (prefix) {
+            name = chaz_Util_join("", prefix, tool, NULL);
+            path = chaz_OS_find_executable(name);
+            if (path) {
+                free(path);
+                return name;
+            }
+            free(name);
+        }
+    }
+
+    return chaz_Util_strdup(tool);
 }
 
 char*
@@ -60,12 +60,21 @@ chaz_CC_test_link(const char *source);
 
 /* Attempt to compile the supplied source code.  If successful, capture the
  * output of the program and return a pointer to a newly allocated buffer.
- * If the compilation fails, return NULL.  The length of the captured
- * output will be placed into the integer pointed to by [output_len].
+ * If the compilation fails or the program times out, return NULL.  The
+ * length of the captured output will be placed into the integer pointed to
+ * by [output_len].
  */
 char*
 chaz_CC_capture_output(const char *source, size_t *output_len);
 
+/* Attempt to compile the supplied source code to an object file.  If
+ * successful, return a newly allocated buffer with the contents of the
+ * object file.  If the compilation fails, return NULL.  The length of the
+ * object file will be placed into the integer pointed to by [obj_len].
+ */
+char*
+chaz_CC_capture_obj(const char *source, size_t *obj_len);
+
 /** Return true if macro is defined.
  */
 int
@@ -148,6 +157,9 @@ chaz_CC_is_gcc(void);
 int
 chaz_CC_is_msvc(void);
 
+int
+chaz_CC_is_clang(void);
+
 int
 chaz_CC_is_sun_c(void);
 
@@ -177,6 +189,26 @@ chaz_CC_link_command(void);
 char*
 chaz_CC_format_archiver_command(const char *target, const char *objects);
 
+/* Like chaz_CC_format_archiver_command, but use a tool that can handle
+ * objects compiled for link-time optimization, like gcc-ar or llvm-ar, if
+ * it's available.
+ */
+char*
+chaz_CC_format_lto_archiver_command(const char *target,
+                                    const char *objects);
+
+/* Create a command for building a thin static library which only
+ * references the object files instead of copying them. Returns NULL if the
+ * archiver doesn't support thin archives.
+ *
+ * @param target The target library filename.
+ * @param objects The list of object files to be referenced by the library.
+ * @param lto_tools Whether to use an archiver that handles LTO objects.
+ */
+char*
+chaz_CC_format_thin_archiver_command(const char *target,
+                                     const char *objects, int lto_tools);
+
 /* Returns a "ranlib" command if valid.
  *
  * @param target The library filename.
@@ -184,6 +216,13 @@ chaz_CC_format_archiver_command(const char *target, const char *objects);
 char*
 chaz_CC_format_ranlib_command(const char *target);
 
+/* Like chaz_CC_format_ranlib_command, but use gcc-ranlib or llvm-ranlib,
+ * if available, so that the index includes the symbols of objects
+ * compiled for link-time optimization.
+ */
+char*
+chaz_CC_format_lto_ranlib_command(const char *target);
+
 /** Returns the filename for a shared library.
  *
  * @param dir The target directory or NULL for the current directory.
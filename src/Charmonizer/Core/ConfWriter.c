@@ -18,32 +18,146 @@
 #include "Charmonizer/Core/ConfWriter.h"
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #define CW_MAX_WRITERS 10
 static struct {
     chaz_ConfWriter *writers[CW_MAX_WRITERS];
     size_t num_writers;
+    unsigned long hash;
+    int num_modules;
+    int host_info;
 } chaz_CW;
 
+/* FNV-1a parameters, 32 bits. */
+#define CW_HASH_OFFSET 2166136261UL
+#define CW_HASH_PRIME  16777619UL
+
+/* Fold a tag identifying the kind of entry and up to two strings into the
+ * running config hash.
+ */
+static void
+chaz_ConfWriter_hash(int tag, const char *str1, const char *str2);
+
+/* Fold the text written by append_conf into the config hash. C89 lacks
+ * vsnprintf, so text with conversions is formatted through a temporary
+ * file.
+ */
+static void
+chaz_ConfWriter_hash_formatted(const char *fmt, va_list args);
+
+/* Write CONFIG_HASH in its own module.  Bypasses start_module so that
+ * nothing is printed.
+ */
+static void
+chaz_ConfWriter_write_config_hash(void);
+
 void
 chaz_ConfWriter_init(void) {
     chaz_CW.num_writers = 0;
+    chaz_CW.hash        = CW_HASH_OFFSET;
+    chaz_CW.num_modules = 0;
+    chaz_CW.host_info   = 0;
     return;
 }
 
 void
 chaz_ConfWriter_clean_up(void) {
     size_t i;
+    if (chaz_CW.num_modules > 0) {
+        chaz_ConfWriter_write_config_hash();
+    }
     for (i = 0; i < chaz_CW.num_writers; i++) {
         chaz_CW.writers[i]->clean_up();
     }
 }
 
+void
+chaz_ConfWriter_allow_host_info(int allow) {
+    chaz_CW.host_info = !!allow;
+}
+
+int
+chaz_ConfWriter_host_info_allowed(void) {
+    return chaz_CW.host_info;
+}
+
+unsigned long
+chaz_ConfWriter_config_hash(void) {
+    return chaz_CW.hash;
+}
+
+static void
+chaz_ConfWriter_hash(int tag, const char *str1, const char *str2) {
+    unsigned long hash = chaz_CW.hash;
+    const char *strings[2];
+    int i;
+
+    strings[0] = str1;
+    strings[1] = str2;
+    hash = ((hash ^ (unsigned long)tag) * CW_HASH_PRIME) & 0xFFFFFFFFUL;
+    for (i = 0; i < 2; i++) {
+        const unsigned char *p = (const unsigned char*)strings[i];
+        if (p) {
+            for (; *p; p++) {
+                hash = ((hash ^ *p) * CW_HASH_PRIME) & 0xFFFFFFFFUL;
+            }
+        }
+        /* Terminate each string so that "ab","c" differs from "a","bc". */
+        hash = (hash * CW_HASH_PRIME) & 0xFFFFFFFFUL;
+    }
+    chaz_CW.hash = hash;
+}
+
+static void
+chaz_ConfWriter_hash_formatted(const char *fmt, va_list args) {
+    static const char temp_path[] = "_charm_conf_hash";
+    FILE   *fh;
+    char   *text;
+    size_t  len;
+
+    if (strchr(fmt, '%') == NULL) {
+        chaz_ConfWriter_hash('A', fmt, NULL);
+        return;
+    }
+
+    fh = fopen(temp_path, "wb");
+    if (fh == NULL) {
+        chaz_Util_die("Can't open '%s'", temp_path);
+    }
+    vfprintf(fh, fmt, args);
+    fclose(fh);
+    text = chaz_Util_slurp_file(temp_path, &len);
+    if (!chaz_Util_remove_and_verify(temp_path)) {
+        chaz_Util_die("Failed to remove '%s'", temp_path);
+    }
+
+    chaz_ConfWriter_hash('A', text, NULL);
+    free(text);
+}
+
+static void
+chaz_ConfWriter_write_config_hash(void) {
+    char value[16];
+    size_t i;
+
+    sprintf(value, "0x%08lX", chaz_CW.hash);
+    for (i = 0; i < chaz_CW.num_writers; i++) {
+        chaz_CW.writers[i]->start_module("ConfigHash");
+        chaz_CW.writers[i]->add_def("CONFIG_HASH", value);
+        chaz_CW.writers[i]->end_module();
+    }
+}
+
 void
 chaz_ConfWriter_append_conf(const char *fmt, ...) {
     va_list args;
     size_t i;
-    
+
+    va_start(args, fmt);
+    chaz_ConfWriter_hash_formatted(fmt, args);
+    va_end(args);
     for (i = 0; i < chaz_CW.num_writers; i++) {
         va_start(args, fmt);
         chaz_CW.writers[i]->vappend_conf(fmt, args);
@@ -54,6 +168,7 @@ chaz_ConfWriter_append_conf(const char *fmt, ...) {
 void
 chaz_ConfWriter_add_def(const char *sym, const char *value) {
     size_t i;
+    chaz_ConfWriter_hash('D', sym, value);
     for (i = 0; i < chaz_CW.num_writers; i++) {
         chaz_CW.writers[i]->add_def(sym, value);
     }
@@ -62,6 +177,7 @@ chaz_ConfWriter_add_def(const char *sym, const char *value) {
 void
 chaz_ConfWriter_add_global_def(const char *sym, const char *value) {
     size_t i;
+    chaz_ConfWriter_hash('G', sym, value);
     for (i = 0; i < chaz_CW.num_writers; i++) {
         chaz_CW.writers[i]->add_global_def(sym, value);
     }
@@ -70,6 +186,7 @@ chaz_ConfWriter_add_global_def(const char *sym, const char *value) {
 void
 chaz_ConfWriter_add_typedef(const char *type, const char *alias) {
     size_t i;
+    chaz_ConfWriter_hash('T', type, alias);
     for (i = 0; i < chaz_CW.num_writers; i++) {
         chaz_CW.writers[i]->add_typedef(type, alias);
     }
@@ -78,6 +195,7 @@ chaz_ConfWriter_add_typedef(const char *type, const char *alias) {
 void
 chaz_ConfWriter_add_global_typedef(const char *type, const char *alias) {
     size_t i;
+    chaz_ConfWriter_hash('U', type, alias);
     for (i = 0; i < chaz_CW.num_writers; i++) {
         chaz_CW.writers[i]->add_global_typedef(type, alias);
     }
@@ -86,6 +204,7 @@ chaz_ConfWriter_add_global_typedef(const char *type, const char *alias) {
 void
 chaz_ConfWriter_add_sys_include(const char *header) {
     size_t i;
+    chaz_ConfWriter_hash('S', header, NULL);
     for (i = 0; i < chaz_CW.num_writers; i++) {
         chaz_CW.writers[i]->add_sys_include(header);
     }
@@ -94,6 +213,7 @@ chaz_ConfWriter_add_sys_include(const char *header) {
 void
 chaz_ConfWriter_add_local_include(const char *header) {
     size_t i;
+    chaz_ConfWriter_hash('L', header, NULL);
     for (i = 0; i < chaz_CW.num_writers; i++) {
         chaz_CW.writers[i]->add_local_include(header);
     }
@@ -102,6 +222,8 @@ chaz_ConfWriter_add_local_include(const char *header) {
 void
 chaz_ConfWriter_start_module(const char *module_name) {
     size_t i;
+    chaz_ConfWriter_hash('M', module_name, NULL);
+    chaz_CW.num_modules++;
     if (chaz_Util_verbosity > 0) {
         printf("Running %s module...\n", module_name);
     }
@@ -90,6 +90,24 @@ chaz_ConfWriter_end_module(void);
 void
 chaz_ConfWriter_add_writer(struct chaz_ConfWriter *writer);
 
+/* Allow probes to record host-specific information such as the compiler
+ * command and flags.  Off by default, so that hosts with identical probe
+ * results produce byte-identical config files and can share compiler
+ * caches.
+ */
+void
+chaz_ConfWriter_allow_host_info(int allow);
+
+int
+chaz_ConfWriter_host_info_allowed(void);
+
+/* Return a 32-bit hash of everything written to the config files so far.
+ * When at least one module was run, the hash is written as CONFIG_HASH
+ * during clean up.
+ */
+unsigned long
+chaz_ConfWriter_config_hash(void);
+
 typedef void
 (*chaz_ConfWriter_clean_up_t)(void);
 typedef void
@@ -20,7 +20,6 @@
 #include "Charmonizer/Core/OperatingSystem.h"
 #include "Charmonizer/Core/Compiler.h"
 #include <ctype.h>
-#include <errno.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -48,7 +47,10 @@ static struct {
     chaz_ConfElem *defs;
     size_t         def_cap;
     size_t         def_count;
-} chaz_ConfWriterC = { NULL, NULL, NULL, 0, 0 };
+    int            split;
+    FILE          *umbrella_fh;
+    char          *module_path;
+} chaz_ConfWriterC = { NULL, NULL, NULL, 0, 0, 0, NULL, NULL };
 static chaz_ConfWriter CWC_conf_writer;
 
 /* Open the charmony.h file handle.  Print supplied text to it, if non-null.
@@ -104,13 +106,16 @@ chaz_ConfWriterC_enable(void) {
     return;
 }
 
+void
+chaz_ConfWriterC_split_modules(void) {
+    chaz_OS_mkdir("charmony");
+    chaz_ConfWriterC.split = 1;
+}
+
 static void
 chaz_ConfWriterC_open_charmony_h(const char *charmony_start) {
     /* Open the filehandle. */
-    chaz_ConfWriterC.fh = fopen("charmony.h", "w+");
-    if (chaz_ConfWriterC.fh == NULL) {
-        chaz_Util_die("Can't open 'charmony.h': %s", strerror(errno));
-    }
+    chaz_ConfWriterC.fh = chaz_Util_open_updated_file("charmony.h");
 
     /* Print supplied text (if any) along with warning, open include guard. */
     if (charmony_start != NULL) {
@@ -130,9 +135,7 @@ static void
 chaz_ConfWriterC_clean_up(void) {
     /* Write the last bit of charmony.h and close. */
     fprintf(chaz_ConfWriterC.fh, "#endif /* H_CHARMONY */\n\n");
-    if (fclose(chaz_ConfWriterC.fh)) {
-        chaz_Util_die("Couldn't close 'charmony.h': %s", strerror(errno));
-    }
+    chaz_Util_close_updated_file(chaz_ConfWriterC.fh, "charmony.h");
 }
 
 static void
@@ -261,9 +264,25 @@ chaz_ConfWriterC_append_local_include_to_conf(const char *header) {
 
 static void
 chaz_ConfWriterC_start_module(const char *module_name) {
-    fprintf(chaz_ConfWriterC.fh, "\n/* %s */\n", module_name);
     chaz_ConfWriterC.MODULE_NAME
         = chaz_ConfWriterC_uppercase_string(module_name);
+    if (chaz_ConfWriterC.split) {
+        /* Redirect output to a module header and include it from the
+         * umbrella charmony.h. */
+        char *path = chaz_Util_join("", "charmony/", module_name, ".h", NULL);
+        fprintf(chaz_ConfWriterC.fh, "#include \"%s\"\n", path);
+        chaz_ConfWriterC.umbrella_fh = chaz_ConfWriterC.fh;
+        chaz_ConfWriterC.module_path = path;
+        chaz_ConfWriterC.fh = chaz_Util_open_updated_file(path);
+        fprintf(chaz_ConfWriterC.fh,
+                "/* Header file auto-generated by Charmonizer. \n"
+                " * DO NOT EDIT THIS FILE!!\n"
+                " */\n\n"
+                "#ifndef H_CHARMONY_%s\n"
+                "#define H_CHARMONY_%s 1\n",
+                chaz_ConfWriterC.MODULE_NAME, chaz_ConfWriterC.MODULE_NAME);
+    }
+    fprintf(chaz_ConfWriterC.fh, "\n/* %s */\n", module_name);
 }
 
 static void
@@ -373,6 +392,17 @@ chaz_ConfWriterC_end_module(void) {
 
     fprintf(chaz_ConfWriterC.fh, "\n");
 
+    if (chaz_ConfWriterC.split) {
+        fprintf(chaz_ConfWriterC.fh, "#endif /* H_CHARMONY_%s */\n\n",
+                chaz_ConfWriterC.MODULE_NAME);
+        chaz_Util_close_updated_file(chaz_ConfWriterC.fh,
+                                     chaz_ConfWriterC.module_path);
+        free(chaz_ConfWriterC.module_path);
+        chaz_ConfWriterC.module_path = NULL;
+        chaz_ConfWriterC.fh = chaz_ConfWriterC.umbrella_fh;
+        chaz_ConfWriterC.umbrella_fh = NULL;
+    }
+
     free(chaz_ConfWriterC.MODULE_NAME);
     chaz_ConfWriterC_clear_def_list();
 }
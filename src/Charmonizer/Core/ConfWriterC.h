@@ -29,6 +29,16 @@ extern "C" {
 void
 chaz_ConfWriterC_enable(void);
 
+/* Write each module to its own header `charmony/<Module>.h` and have
+ * charmony.h include them all.  Translation units which only need a single
+ * module can include its header directly and skip the system headers pulled
+ * in by the others.  Module headers don't include each other, so a module
+ * that builds on another (e.g. IntegerLimits on IntegerTypes) must be
+ * included after it.
+ */
+void
+chaz_ConfWriterC_split_modules(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -17,7 +17,6 @@
 #include "Charmonizer/Core/Util.h"
 #include "Charmonizer/Core/ConfWriter.h"
 #include "Charmonizer/Core/ConfWriterPerl.h"
-#include <errno.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -75,10 +74,7 @@ chaz_ConfWriterPerl_enable(void) {
 static void
 chaz_ConfWriterPerl_open_config_pm(void) {
     /* Open the filehandle. */
-    chaz_CWPerl.fh = fopen("Charmony.pm", "w+");
-    if (chaz_CWPerl.fh == NULL) {
-        chaz_Util_die("Can't open 'Charmony.pm': %s", strerror(errno));
-    }
+    chaz_CWPerl.fh = chaz_Util_open_updated_file("Charmony.pm");
 
     /* Start the module. */
     fprintf(chaz_CWPerl.fh,
@@ -100,9 +96,7 @@ static void
 chaz_ConfWriterPerl_clean_up(void) {
     /* Write the last bit of Charmony.pm and close. */
     fprintf(chaz_CWPerl.fh, "\n1;\n\n");
-    if (fclose(chaz_CWPerl.fh)) {
-        chaz_Util_die("Couldn't close 'Charmony.pm': %s", strerror(errno));
-    }
+    chaz_Util_close_updated_file(chaz_CWPerl.fh, "Charmony.pm");
 }
 
 static void
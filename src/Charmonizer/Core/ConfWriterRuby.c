@@ -17,7 +17,6 @@
 #include "Charmonizer/Core/Util.h"
 #include "Charmonizer/Core/ConfWriter.h"
 #include "Charmonizer/Core/ConfWriterRuby.h"
-#include <errno.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -75,10 +74,7 @@ chaz_ConfWriterRuby_enable(void) {
 static void
 chaz_ConfWriterRuby_open_config_rb(void) {
     /* Open the filehandle. */
-    chaz_CWRuby.fh = fopen("Charmony.rb", "w+");
-    if (chaz_CWRuby.fh == NULL) {
-        chaz_Util_die("Can't open 'Charmony.rb': %s", strerror(errno));
-    }
+    chaz_CWRuby.fh = chaz_Util_open_updated_file("Charmony.rb");
 
     /* Start the module. */
     fprintf(chaz_CWRuby.fh,
@@ -98,9 +94,7 @@ static void
 chaz_ConfWriterRuby_clean_up(void) {
     /* Write the last bit of Charmony.rb and close. */
     fprintf(chaz_CWRuby.fh, "\nend\n\n");
-    if (fclose(chaz_CWRuby.fh)) {
-        chaz_Util_die("Couldn't close 'Charmony.rb': %s", strerror(errno));
-    }
+    chaz_Util_close_updated_file(chaz_CWRuby.fh, "Charmony.rb");
 }
 
 static void
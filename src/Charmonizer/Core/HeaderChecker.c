@@ -56,6 +56,29 @@ chaz_HeadCheck_add_to_cache(chaz_CHeader *header);
 static void
 chaz_HeadCheck_maybe_add_to_cache(const char *header_name, int exists);
 
+/* Try to compile a probe for a range of struct members. On success, mark the
+ * members as existing and extract their offsets from the object file.
+ * Otherwise, bisect the range. Return the number of members found.
+ */
+static int
+chaz_HeadCheck_probe_members(chaz_HeadCheckMember *members, int num_members,
+                             int base, const char *includes);
+
+/* Scan an object file for the offset records emitted by probe_members.
+ */
+static void
+chaz_HeadCheck_extract_offsets(chaz_HeadCheckMember *members, int num_members,
+                               int base, const char *obj, size_t obj_len);
+
+/* Marker preceding the index and offset of a member in the object file. It's
+ * spelled out character by character in the probe so that only the data
+ * section contains it.
+ */
+#define CHAZ_HEADCHECK_MARKER     "chzMbR"
+#define CHAZ_HEADCHECK_MARKER_LEN 6
+#define CHAZ_HEADCHECK_IDX_LEN    4
+#define CHAZ_HEADCHECK_OFF_LEN    8
+
 void
 chaz_HeadCheck_init(void) {
     chaz_CHeader *null_header = (chaz_CHeader*)malloc(sizeof(chaz_CHeader));
@@ -156,21 +179,139 @@ chaz_HeadCheck_defines_symbol(const char *symbol, const char *includes) {
 int
 chaz_HeadCheck_contains_member(const char *struct_name, const char *member,
                                const char *includes) {
-    static const char contains_code[] =
-        CHAZ_QUOTE(  #include <stddef.h>                           )
-        CHAZ_QUOTE(  %s                                            )
-        CHAZ_QUOTE(  int main() { return offsetof(%s, %s); }       );
-    long needed = sizeof(contains_code)
-                  + strlen(struct_name)
-                  + strlen(member)
-                  + strlen(includes)
-                  + 10;
-    char *buf = (char*)malloc(needed);
-    int retval;
-    sprintf(buf, contains_code, includes, struct_name, member);
-    retval = chaz_CC_test_compile(buf);
-    free(buf);
-    return retval;
+    chaz_HeadCheckMember members[2];
+
+    members[0].struct_name = struct_name;
+    members[0].member      = member;
+    members[1].struct_name = NULL;
+    members[1].member      = NULL;
+
+    return chaz_HeadCheck_contains_members(members, includes);
+}
+
+int
+chaz_HeadCheck_contains_members(chaz_HeadCheckMember *members,
+                                const char *includes) {
+    int num_members = 0;
+
+    while (members[num_members].struct_name != NULL) {
+        members[num_members].exists = false;
+        members[num_members].offset = -1;
+        num_members++;
+    }
+    if (num_members == 0) { return 0; }
+
+    return chaz_HeadCheck_probe_members(members, num_members, 0, includes);
+}
+
+static int
+chaz_HeadCheck_probe_members(chaz_HeadCheckMember *members, int num_members,
+                             int base, const char *includes) {
+    static const char prologue[] =
+        CHAZ_QUOTE(  #include <stddef.h>                                   )
+        CHAZ_QUOTE(  %s                                                    )
+        CHAZ_QUOTE(  #define CHAZ_D(n, d) (char)('0' + (int)((n) / (d) %% 10)) );
+    static const char member_code[] =
+        "const char chaz_member_%d[] = {\n"
+        "    'c', 'h', 'z', 'M', 'b', 'R',\n"
+        "    CHAZ_D(%d, 1000), CHAZ_D(%d, 100), CHAZ_D(%d, 10), CHAZ_D(%d, 1),\n"
+        "    CHAZ_D(offsetof(%s, %s), 10000000L),\n"
+        "    CHAZ_D(offsetof(%s, %s), 1000000L),\n"
+        "    CHAZ_D(offsetof(%s, %s), 100000L),\n"
+        "    CHAZ_D(offsetof(%s, %s), 10000L),\n"
+        "    CHAZ_D(offsetof(%s, %s), 1000L),\n"
+        "    CHAZ_D(offsetof(%s, %s), 100L),\n"
+        "    CHAZ_D(offsetof(%s, %s), 10L),\n"
+        "    CHAZ_D(offsetof(%s, %s), 1L)\n"
+        "};\n";
+    size_t needed = sizeof(prologue) + strlen(includes) + 10;
+    char *code;
+    char *obj;
+    size_t obj_len;
+    int i;
+
+    for (i = 0; i < num_members; i++) {
+        needed += sizeof(member_code) + 5 * 10
+                  + 8 * (strlen(members[i].struct_name)
+                         + strlen(members[i].member));
+    }
+    code = (char*)malloc(needed);
+    sprintf(code, prologue, includes);
+    for (i = 0; i < num_members; i++) {
+        const char *s = members[i].struct_name;
+        const char *m = members[i].member;
+        int idx = base + i;
+        sprintf(code + strlen(code), member_code, idx, idx, idx, idx, idx,
+                s, m, s, m, s, m, s, m, s, m, s, m, s, m, s, m);
+    }
+
+    obj = chaz_CC_capture_obj(code, &obj_len);
+    free(code);
+
+    if (obj != NULL) {
+        for (i = 0; i < num_members; i++) {
+            members[i].exists = true;
+        }
+        chaz_HeadCheck_extract_offsets(members, num_members, base, obj,
+                                       obj_len);
+        free(obj);
+        return num_members;
+    }
+    else if (num_members == 1) {
+        return 0;
+    }
+    else {
+        int half = num_members / 2;
+        return chaz_HeadCheck_probe_members(members, half, base, includes)
+               + chaz_HeadCheck_probe_members(members + half,
+                                              num_members - half,
+                                              base + half, includes);
+    }
+}
+
+static void
+chaz_HeadCheck_extract_offsets(chaz_HeadCheckMember *members, int num_members,
+                               int base, const char *obj, size_t obj_len) {
+    const size_t record_len = CHAZ_HEADCHECK_MARKER_LEN
+                              + CHAZ_HEADCHECK_IDX_LEN
+                              + CHAZ_HEADCHECK_OFF_LEN;
+    size_t i;
+
+    /* Offsets stay at -1 if the compiler didn't emit plain data, e.g. with
+     * link-time optimization. */
+    for (i = 0; i + record_len <= obj_len; i++) {
+        const char *record = obj + i;
+        const char *digits = record + CHAZ_HEADCHECK_MARKER_LEN;
+        long idx    = 0;
+        long offset = 0;
+        int  j;
+
+        if (record[0] != 'c'
+            || memcmp(record, CHAZ_HEADCHECK_MARKER,
+                      CHAZ_HEADCHECK_MARKER_LEN) != 0
+           ) {
+            continue;
+        }
+        for (j = 0; j < CHAZ_HEADCHECK_IDX_LEN + CHAZ_HEADCHECK_OFF_LEN; j++) {
+            if (digits[j] < '0' || digits[j] > '9') { break; }
+        }
+        if (j < CHAZ_HEADCHECK_IDX_LEN + CHAZ_HEADCHECK_OFF_LEN) { continue; }
+
+        for (j = 0; j < CHAZ_HEADCHECK_IDX_LEN; j++) {
+            idx = idx * 10 + (digits[j] - '0');
+        }
+        for (j = CHAZ_HEADCHECK_IDX_LEN;
+             j < CHAZ_HEADCHECK_IDX_LEN + CHAZ_HEADCHECK_OFF_LEN;
+             j++
+            ) {
+            offset = offset * 10 + (digits[j] - '0');
+        }
+        idx -= base;
+        if (idx >= 0 && idx < num_members) {
+            members[idx].offset = offset;
+        }
+        i += record_len - 1;
+    }
 }
 
 int
@@ -26,6 +26,17 @@ extern "C" {
 
 #include "Charmonizer/Core/Defines.h"
 
+/* A struct member to check for with chaz_HeadCheck_contains_members.
+ * `exists` and `offset` are filled in by the check.  `offset` is -1 if the
+ * member doesn't exist or its offset couldn't be determined.
+ */
+typedef struct chaz_HeadCheckMember {
+    const char *struct_name;
+    const char *member;
+    int         exists;
+    long        offset;
+} chaz_HeadCheckMember;
+
 /* Bootstrap the HeadCheck.  Call this before anything else.
  */
 void
@@ -53,6 +64,17 @@ int
 chaz_HeadCheck_contains_member(const char *struct_name, const char *member,
                                const char *includes);
 
+/* Check for several struct members at once.  `members` is an array
+ * terminated by an entry with a NULL `struct_name`.  If all members are
+ * present, a single test-compile resolves them; otherwise the list is
+ * bisected until the missing members are isolated.  The offsets of the
+ * members are extracted from the compiled object file.  Return the number
+ * of members found.
+ */
+int
+chaz_HeadCheck_contains_members(chaz_HeadCheckMember *members,
+                                const char *includes);
+
 /*
  * Return the size of the type or 0 if can't be determined. Only checks for
  * sizes 1, 2, 4, 8. If hint != 0, try this size first to speed up the
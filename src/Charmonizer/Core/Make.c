@@ -27,20 +27,22 @@
 #define CHAZ_MAKEBINARY_EXE         1
 #define CHAZ_MAKEBINARY_STATIC_LIB  2
 #define CHAZ_MAKEBINARY_SHARED_LIB  3
+#define CHAZ_MAKEBINARY_OBJECT_GROUP 4
 
 struct chaz_MakeVar {
-    char   *name;
-    char   *value;
-    size_t  num_elements;
+    char     *name;
+    chaz_Buf  value;
+    size_t    num_elements;
 };
 
 struct chaz_MakeRule {
-    char *targets;
-    char *prereqs;
-    char *commands;
+    chaz_Buf targets;
+    chaz_Buf prereqs;
+    chaz_Buf commands;
 };
 
 struct chaz_MakeBinary {
+    int             type;
     chaz_MakeRule  *rule;  /* Owned by MakeBinary. */
 
     chaz_MakeVar   *obj_var;
@@ -49,14 +51,37 @@ struct chaz_MakeBinary {
     size_t          num_sources;
     char          **single_sources;  /* Only sources from add_src_file. */
     size_t          num_single_sources;
+    char          **flagged_sources;  /* Sources with their own flags. */
+    char          **flagged_cflags;   /* Extra flags of flagged_sources. */
+    size_t          num_flagged_sources;
     char          **dirs;
     size_t          num_dirs;
 
+    struct chaz_MakeBinary **groups;  /* Object groups linked in. */
+    size_t                   num_groups;
+    int                      pic;  /* Group compiled as PIC. */
+
     chaz_MakeVar   *cflags_var;
     chaz_CFlags    *cflags;
 
     chaz_MakeVar   *ldflags_var;
     chaz_CFlags    *ldflags;
+
+    int                      num_unity_batches;
+    chaz_Make_file_filter_t  unity_filter;
+    void                    *unity_filter_ctx;
+
+    char           *pch_header;
+    char           *pch_file;   /* Target of the PCH rule. */
+    char           *pch_flags;  /* Flags to use the PCH. */
+
+    int             lto;
+    int             lto_tools;
+    int             split_dwarf;
+    int             optimize_loading;
+    int             response_file;
+    int             thin_archive;
+    int             installed;
 };
 
 struct chaz_MakeFile {
@@ -71,6 +96,11 @@ struct chaz_MakeFile {
     chaz_MakeRule    *distclean;
     chaz_MakeBinary **binaries;
     size_t            num_binaries;
+    chaz_MakeRule    *pgo_train;
+    char            **variant_names;
+    chaz_CFlags     **variant_cflags;
+    size_t            num_variants;
+    int               finalized;
 };
 
 typedef struct {
@@ -85,11 +115,196 @@ static struct {
     char     *make_command;
     int       shell_type;
     int       supports_pattern_rules;
+    int       make_detected;
+    int       dep_files;
+    int       launcher;
+    int       pgo;
+    int       timing;
+    int       variants;
 } chaz_Make = {
     NULL, NULL,
-    0, 0
+    0, 0, 0, 0, 0, 0, 0, 0
 };
 
+/* Helper which runs a build command and appends the elapsed time to a log
+ * file. The command is run directly, without another shell. With
+ * --report, it prints the slowest targets from the log.
+ */
+static const char chaz_Make_build_timer_code[] =
+    CHAZ_QUOTE(  #ifndef _WIN32                                        )
+    CHAZ_QUOTE(    #define _XOPEN_SOURCE 500                           )
+    CHAZ_QUOTE(    #include <sys/types.h>                              )
+    CHAZ_QUOTE(    #include <sys/time.h>                               )
+    CHAZ_QUOTE(    #include <sys/wait.h>                               )
+    CHAZ_QUOTE(    #include <unistd.h>                                 )
+    CHAZ_QUOTE(  #else                                                 )
+    CHAZ_QUOTE(    #include <windows.h>                                )
+    CHAZ_QUOTE(    #include <process.h>                                )
+    CHAZ_QUOTE(  #endif                                                )
+    CHAZ_QUOTE(  #include <errno.h>                                    )
+    CHAZ_QUOTE(  #include <stdio.h>                                    )
+    CHAZ_QUOTE(  #include <stdlib.h>                                   )
+    CHAZ_QUOTE(  #include <string.h>                                   )
+    CHAZ_QUOTE(  typedef struct { char *t; double ms; long n; } entry; )
+    CHAZ_QUOTE(  static double now_ms(void) {                          )
+    CHAZ_QUOTE(  #ifdef _WIN32                                         )
+    CHAZ_QUOTE(      return (double)GetTickCount();                    )
+    CHAZ_QUOTE(  #else                                                 )
+    CHAZ_QUOTE(      struct timeval tv;                                )
+    CHAZ_QUOTE(      gettimeofday(&tv, NULL);                          )
+    CHAZ_QUOTE(      return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;  )
+    CHAZ_QUOTE(  #endif                                                )
+    CHAZ_QUOTE(  }                                                     )
+    CHAZ_QUOTE(  static int by_target(const void *va, const void *vb) { )
+    CHAZ_QUOTE(      const entry *a = (const entry*)va;                )
+    CHAZ_QUOTE(      const entry *b = (const entry*)vb;                )
+    CHAZ_QUOTE(      int cmp = strcmp(a->t, b->t);                     )
+    CHAZ_QUOTE(      if (cmp != 0) { return cmp; }                     )
+    CHAZ_QUOTE(      return a->n < b->n ? -1 : 1;                      )
+    CHAZ_QUOTE(  }                                                     )
+    CHAZ_QUOTE(  static int by_time(const void *va, const void *vb) {  )
+    CHAZ_QUOTE(      const entry *a = (const entry*)va;                )
+    CHAZ_QUOTE(      const entry *b = (const entry*)vb;                )
+    CHAZ_QUOTE(      return a->ms < b->ms ? 1 : a->ms > b->ms ? -1 : 0; )
+    CHAZ_QUOTE(  }                                                     )
+    CHAZ_QUOTE(  static int report(const char *log) {                  )
+    CHAZ_QUOTE(      FILE *fh = fopen(log, "r");                       )
+    CHAZ_QUOTE(      char line[4096];                                  )
+    CHAZ_QUOTE(      entry *e = NULL;                                  )
+    CHAZ_QUOTE(      size_t num = 0;                                   )
+    CHAZ_QUOTE(      size_t kept = 0;                                  )
+    CHAZ_QUOTE(      size_t i;                                         )
+    CHAZ_QUOTE(      double total = 0.0;                               )
+    CHAZ_QUOTE(      if (fh == NULL) {                                 )
+    CHAZ_QUOTE(          printf("no timings\n");                       )
+    CHAZ_QUOTE(          return 0;                                     )
+    CHAZ_QUOTE(      }                                                 )
+    CHAZ_QUOTE(      while (fgets(line, sizeof(line), fh)) {           )
+    CHAZ_QUOTE(          char *t = strchr(line, '\t');                 )
+    CHAZ_QUOTE(          if (t == NULL) { continue; }                  )
+    CHAZ_QUOTE(          *t++ = '\0';                                  )
+    CHAZ_QUOTE(          t[strcspn(t, "\r\n")] = '\0';                 )
+    CHAZ_QUOTE(          if (num % 256 == 0) {                         )
+    CHAZ_QUOTE(              size_t size = (num + 256) * sizeof(entry); )
+    CHAZ_QUOTE(              e = (entry*)realloc(e, size);             )
+    CHAZ_QUOTE(          }                                             )
+    CHAZ_QUOTE(          e[num].ms = atof(line);                       )
+    CHAZ_QUOTE(          e[num].t = (char*)malloc(strlen(t) + 1);      )
+    CHAZ_QUOTE(          strcpy(e[num].t, t);                          )
+    CHAZ_QUOTE(          e[num].n = (long)num;                         )
+    CHAZ_QUOTE(          num++;                                        )
+    CHAZ_QUOTE(      }                                                 )
+    CHAZ_QUOTE(      fclose(fh);                                       )
+    CHAZ_QUOTE(      if (num == 0) { return 0; }                       )
+    CHAZ_QUOTE(      qsort(e, num, sizeof(entry), by_target);          )
+    CHAZ_QUOTE(      for (i = 0; i < num; i++) {                       )
+    CHAZ_QUOTE(          if (i + 1 < num && !strcmp(e[i].t, e[i+1].t)) { )
+    CHAZ_QUOTE(              continue;                                 )
+    CHAZ_QUOTE(          }                                             )
+    CHAZ_QUOTE(          e[kept++] = e[i];                             )
+    CHAZ_QUOTE(          total += e[i].ms;                             )
+    CHAZ_QUOTE(      }                                                 )
+    CHAZ_QUOTE(      qsort(e, kept, sizeof(entry), by_time);           )
+    CHAZ_QUOTE(      printf("%lu targets, ", (unsigned long)kept);     )
+    CHAZ_QUOTE(      printf("%.2f s total\n", total / 1000.0);        )
+    CHAZ_QUOTE(      for (i = 0; i < kept && i < 20; i++) {            )
+    CHAZ_QUOTE(          double pct = e[i].ms * 100.0 / total;         )
+    CHAZ_QUOTE(          if (total <= 0.0) { pct = 0.0; }              )
+    CHAZ_QUOTE(          printf("%9.2f s %5.1f%%  ", e[i].ms / 1000.0, pct); )
+    CHAZ_QUOTE(          printf("%s\n", e[i].t);                       )
+    CHAZ_QUOTE(      }                                                 )
+    CHAZ_QUOTE(      return 0;                                         )
+    CHAZ_QUOTE(  }                                                     )
+    CHAZ_QUOTE(  #ifdef _WIN32                                         )
+    CHAZ_QUOTE(  static char *quote_arg(const char *a) {               )
+    CHAZ_QUOTE(      char *q = (char*)malloc(2 * strlen(a) + 3);       )
+    CHAZ_QUOTE(      size_t n = 0;                                     )
+    CHAZ_QUOTE(      if (a[0] != '\0' && !strpbrk(a, " \t\"")) {        )
+    CHAZ_QUOTE(          strcpy(q, a);                                 )
+    CHAZ_QUOTE(          return q;                                     )
+    CHAZ_QUOTE(      }                                                 )
+    CHAZ_QUOTE(      q[n++] = '"';                                     )
+    CHAZ_QUOTE(      while (*a) {                                      )
+    CHAZ_QUOTE(          size_t num = strspn(a, "\\");                 )
+    CHAZ_QUOTE(          size_t out = num;                             )
+    CHAZ_QUOTE(          if (a[num] == '"') { out = 2 * num + 1; }     )
+    CHAZ_QUOTE(          if (a[num] == '\0') { out = 2 * num; }        )
+    CHAZ_QUOTE(          memset(q + n, '\\', out);                     )
+    CHAZ_QUOTE(          n += out;                                     )
+    CHAZ_QUOTE(          a += num;                                     )
+    CHAZ_QUOTE(          if (*a) { q[n++] = *a++; }                    )
+    CHAZ_QUOTE(      }                                                 )
+    CHAZ_QUOTE(      q[n++] = '"';                                     )
+    CHAZ_QUOTE(      q[n] = '\0';                                      )
+    CHAZ_QUOTE(      return q;                                         )
+    CHAZ_QUOTE(  }                                                     )
+    CHAZ_QUOTE(  #endif                                                )
+    CHAZ_QUOTE(  static int run(char **args) {                         )
+    CHAZ_QUOTE(  #ifdef _WIN32                                         )
+    CHAZ_QUOTE(      size_t num = 0;                                   )
+    CHAZ_QUOTE(      size_t i;                                         )
+    CHAZ_QUOTE(      char **quoted;                                    )
+    CHAZ_QUOTE(      const char * const *cargs;                        )
+    CHAZ_QUOTE(      intptr_t status;                                  )
+    CHAZ_QUOTE(      while (args[num]) { num++; }                      )
+    CHAZ_QUOTE(      quoted = (char**)calloc(num + 1, sizeof(char*));  )
+    CHAZ_QUOTE(      for (i = 0; i < num; i++) {                       )
+    CHAZ_QUOTE(          quoted[i] = quote_arg(args[i]);               )
+    CHAZ_QUOTE(      }                                                 )
+    CHAZ_QUOTE(      cargs = (const char * const *)quoted;             )
+    CHAZ_QUOTE(      status = _spawnvp(_P_WAIT, args[0], cargs);       )
+    CHAZ_QUOTE(      if (status == -1) {                               )
+    CHAZ_QUOTE(          perror(args[0]);                              )
+    CHAZ_QUOTE(          return 127;                                   )
+    CHAZ_QUOTE(      }                                                 )
+    CHAZ_QUOTE(      return (int)status;                               )
+    CHAZ_QUOTE(  #else                                                 )
+    CHAZ_QUOTE(      int status;                                       )
+    CHAZ_QUOTE(      pid_t pid = fork();                               )
+    CHAZ_QUOTE(      if (pid < 0) {                                    )
+    CHAZ_QUOTE(          perror("fork");                               )
+    CHAZ_QUOTE(          return 127;                                   )
+    CHAZ_QUOTE(      }                                                 )
+    CHAZ_QUOTE(      if (pid == 0) {                                   )
+    CHAZ_QUOTE(          execvp(args[0], args);                        )
+    CHAZ_QUOTE(          perror(args[0]);                              )
+    CHAZ_QUOTE(          _exit(127);                                   )
+    CHAZ_QUOTE(      }                                                 )
+    CHAZ_QUOTE(      while (waitpid(pid, &status, 0) < 0) {            )
+    CHAZ_QUOTE(          if (errno != EINTR) { return 127; }           )
+    CHAZ_QUOTE(      }                                                 )
+    CHAZ_QUOTE(      if (WIFEXITED(status)) {                          )
+    CHAZ_QUOTE(          return WEXITSTATUS(status);                   )
+    CHAZ_QUOTE(      }                                                 )
+    CHAZ_QUOTE(      return 128 + WTERMSIG(status);                    )
+    CHAZ_QUOTE(  #endif                                                )
+    CHAZ_QUOTE(  }                                                     )
+    CHAZ_QUOTE(  int main(int argc, char **argv) {                     )
+    CHAZ_QUOTE(      double start;                                     )
+    CHAZ_QUOTE(      int status;                                       )
+    CHAZ_QUOTE(      FILE *fh;                                         )
+    CHAZ_QUOTE(      if (argc == 3 && !strcmp(argv[2], "--report")) {  )
+    CHAZ_QUOTE(          return report(argv[1]);                       )
+    CHAZ_QUOTE(      }                                                 )
+    CHAZ_QUOTE(      if (argc < 4) { return 2; }                       )
+    CHAZ_QUOTE(      start  = now_ms();                                )
+    CHAZ_QUOTE(      status = run(argv + 3);                           )
+    CHAZ_QUOTE(      fh = fopen(argv[1], "a");                         )
+    CHAZ_QUOTE(      if (fh) {                                         )
+    CHAZ_QUOTE(          double ms = now_ms() - start;                 )
+    CHAZ_QUOTE(          fprintf(fh, "%.1f\t%s\n", ms, argv[2]);        )
+    CHAZ_QUOTE(          fclose(fh);                                   )
+    CHAZ_QUOTE(      }                                                 )
+    CHAZ_QUOTE(      return status;                                    )
+    CHAZ_QUOTE(  }                                                     );
+
+/* Detect the make utility the first time it's needed. Running test
+ * makefiles is slow, so it's skipped entirely unless a Makefile is written
+ * or the make command is requested.
+ */
+static void
+S_chaz_Make_detect_make(void);
+
 /* Detect make command.
  *
  * The argument list must be a NULL-terminated series of different spellings
@@ -114,20 +329,188 @@ S_chaz_MakeFile_add_binary(chaz_MakeFile *self, int type, const char *basename,
 static void
 S_chaz_MakeFile_add_install_dir(chaz_MakeFile *self, const char *dir);
 
+/* Append the commands of rule [other] to [self]. If [unique] is true,
+ * commands that [self] already contains are skipped.
+ */
+static void
+S_chaz_MakeRule_merge_commands(chaz_MakeRule *self, chaz_MakeRule *other,
+                               int unique);
+
+/* Return the rule of [self] with the same targets as [rule] or NULL if
+ * there's none. Die if the targets only partly overlap.
+ */
+static chaz_MakeRule*
+S_chaz_MakeFile_find_rule(chaz_MakeFile *self, chaz_MakeRule *rule);
+
+/* Return a copy of the first word that both space-separated lists contain
+ * or NULL if there's none.
+ */
+static char*
+S_chaz_Make_common_word(const char *words1, const char *words2);
+
 static void
 S_chaz_MakeFile_write_install_vars(FILE *out);
 
+/* Return the value of an installation directory variable like PREFIX or
+ * LIBDIR or NULL if [name] isn't such a variable.
+ */
+static char*
+S_chaz_Make_install_var(const char *name);
+
 static void
 S_chaz_MakeFile_write_binary_rules(chaz_MakeBinary *binary, FILE *out);
 
+/* Write a rule for each object of [sources] except for sources with
+ * their own flags.
+ */
+static void
+S_chaz_MakeFile_write_object_rules(chaz_MakeBinary *binary, char **sources,
+                                   const char *cflags, FILE *out);
+
+/* Write the rules for sources added with add_src_file_with_flags. */
+static void
+S_chaz_MakeFile_write_flagged_object_rules(chaz_MakeBinary *binary,
+                                           FILE *out);
+
+/* Write a rule to compile a single [source] with [cflags]. */
 static void
-S_chaz_MakeFile_write_object_rules(char **sources, const char *command,
-                                   FILE *out);
+S_chaz_MakeFile_write_object_rule(const char *source, const char *cflags,
+                                  FILE *out);
 
 static void
 S_chaz_MakeFile_write_pattern_rules(char **dirs, const char *command,
                                     FILE *out);
 
+/* Complete the variables and rules of a MakeFile before it is written.
+ * This is only done once, so a MakeFile can be written in several formats.
+ */
+static void
+S_chaz_MakeFile_finalize(chaz_MakeFile *self);
+
+/* Compile the object groups linked into shared libraries that optimize
+ * dynamic loading with -fno-semantic-interposition, too.
+ */
+static void
+S_chaz_MakeFile_finalize_loading_groups(chaz_MakeFile *self);
+
+/* Return true if the objects of [binary] and of all its object groups are
+ * compiled with hidden symbols.
+ */
+static int
+S_chaz_MakeBinary_symbols_hidden(chaz_MakeBinary *binary);
+
+/* Write the targets for profile-guided optimization. */
+static void
+S_chaz_MakeFile_write_pgo_rules(chaz_MakeFile *self, FILE *out);
+
+/* Write a rule for each build variant that builds all binaries with a
+ * recursive make invocation.
+ */
+static void
+S_chaz_MakeFile_write_variant_rules(chaz_MakeFile *self, FILE *out);
+
+/* Return a new rule for the 'build-report' target or NULL if builds
+ * aren't timed. It's written after the binaries, so that it doesn't
+ * become the default target.
+ */
+static chaz_MakeRule*
+S_chaz_Make_build_report_rule(void);
+
+/* Write build.ninja without updating the distclean rule. */
+static void
+S_chaz_MakeFile_do_write_ninja(chaz_MakeFile *self);
+
+/* Write the ninja rules and build statements for a binary. */
+static void
+S_chaz_MakeFile_write_ninja_binary(chaz_MakeFile *self,
+                                   chaz_MakeBinary *binary, FILE *out);
+
+/* Write a ninja rule that compiles '$in' to '$out' with [cflags]. */
+static void
+S_chaz_MakeFile_write_ninja_cc_rule(chaz_MakeFile *self, const char *name,
+                                    const char *cflags, FILE *out);
+
+/* Write a MakeRule as ninja rule named [name] with the additional rule
+ * [bindings] and a build statement. Rules without commands become phony.
+ */
+static void
+S_chaz_MakeFile_write_ninja_rule(chaz_MakeFile *self, chaz_MakeRule *rule,
+                                 const char *name, const char *bindings,
+                                 FILE *out);
+
+/* Write a ninja build statement. [targets], [inputs] and [implicit] are
+ * make syntax and may be NULL except for [targets].
+ */
+static void
+S_chaz_MakeFile_write_ninja_build(chaz_MakeFile *self, const char *targets,
+                                  const char *rule, const char *inputs,
+                                  const char *implicit, FILE *out);
+
+/* Convert the commands of a MakeRule to a single ninja command. */
+static char*
+S_chaz_MakeFile_ninja_command(chaz_MakeFile *self, const char *commands);
+
+/* Expand a list of paths in make syntax to ninja paths. */
+static char*
+S_chaz_MakeFile_ninja_paths(chaz_MakeFile *self, const char *string);
+
+/* Expand all make variables in [string] and convert the automatic
+ * variables '$@' and '$<' to their ninja counterparts.
+ */
+static char*
+S_chaz_MakeFile_ninja_expand(chaz_MakeFile *self, const char *string,
+                             int depth);
+
+/* Return a reference to the ninja variable [name]. Die if [name] isn't a
+ * valid ninja variable name.
+ */
+static char*
+S_chaz_MakeFile_ninja_var_ref(const char *name);
+
+/* Return the unexpanded value of a make variable or NULL if it isn't
+ * defined.
+ */
+static char*
+S_chaz_MakeFile_var_value(chaz_MakeFile *self, const char *name);
+
+/* Replace the suffix [from] with [to] in a list of words like make's
+ * substitution references.
+ */
+static char*
+S_chaz_Make_subst_suffix(const char *words, const char *from,
+                         const char *to);
+
+/* Return the build directory specified with --builddir or NULL. */
+static const char*
+S_chaz_Make_builddir(void);
+
+/* Return [path] below $(BUILDDIR). Parent directory components are mapped
+ * to "__" and absolute prefixes to "_root" or "C_", so that the result
+ * can't escape the build directory.
+ */
+static char*
+S_chaz_Make_builddir_path(const char *path);
+
+/* Return the compiler launcher to use in the Makefile or NULL. */
+static char*
+S_chaz_Make_compiler_launcher(void);
+
+/* Compile the build timer if --build-timing was given. Return true if
+ * compile and link commands should be timed.
+ */
+static int
+S_chaz_Make_build_timing(void);
+
+/* Return the value of the BUILD_TIMER variable. */
+static char*
+S_chaz_Make_build_timer_var(void);
+
+/* Return the command to compile [source] to "$@" with the additional
+ * [cflags] which may be NULL.
+ */
+static char*
+S_chaz_MakeFile_compile_command(const char *cflags, const char *source);
+
 static chaz_MakeRule*
 S_chaz_MakeRule_new(const char *target, const char *prereq);
 
@@ -140,12 +523,100 @@ S_chaz_MakeRule_write(chaz_MakeRule *self, FILE *out);
 static void
 S_chaz_MakeBinary_destroy(chaz_MakeBinary *self);
 
+/* Set the archiver command of a static library. */
+static void
+S_chaz_MakeBinary_set_archiver_command(chaz_MakeBinary *self);
+
+/* Write the objects of a binary to a response file if requested or if the
+ * list is long and pass the response file to the archiver or linker.
+ */
+static void
+S_chaz_MakeFile_prepare_response_file(chaz_MakeFile *self,
+                                      chaz_MakeBinary *binary);
+
+/* Replace all occurrences of [from] in the commands of a rule with [to]. */
+static void
+S_chaz_MakeRule_replace_in_commands(chaz_MakeRule *self, const char *from,
+                                    const char *to);
+
+/* Append an element to a NULL-terminated list of strings created with a
+ * single NULL entry. The list grows geometrically. Returns the new list.
+ */
+static char**
+S_chaz_Make_list_push(char **list, size_t *num_elements, char *element);
+
 static void
 S_chaz_MakeBinary_list_files_callback(const char *dir, char *file,
                                       void *context);
 static void
 S_chaz_MakeBinary_do_add_src_file(chaz_MakeBinary *self, const char *path);
 
+/** Return the index of [source] in the list of sources with their own
+ * flags or -1 if it isn't such a source.
+ */
+static int
+S_chaz_MakeBinary_flagged_index(chaz_MakeBinary *self, const char *source);
+
+/** Return the compile flags for a source with its own flags.
+ */
+static char*
+S_chaz_MakeBinary_flagged_cflags(chaz_MakeBinary *self, int index);
+
+/** Assign the sources of a binary to unity batches. Returns an array with
+ * the batch index of every source or -1 if the source isn't part of a
+ * batch. The number of batches actually used is stored in [num_batches].
+ * Returns NULL if unity builds are disabled.
+ */
+static int*
+S_chaz_MakeBinary_unity_batches(chaz_MakeBinary *self, int *num_batches);
+
+/** Return the path to the generated C file for a unity batch.
+ */
+static char*
+S_chaz_MakeBinary_unity_path(chaz_MakeBinary *self, int batch);
+
+/** Return a path for a generated file, formed from the lowercased name of
+ * the binary and a suffix.
+ */
+static char*
+S_chaz_MakeBinary_generated_path(chaz_MakeBinary *self, const char *suffix);
+
+/** Return the path of the PCH created by MSVC, below the build directory
+ * if there is one.
+ */
+static char*
+S_chaz_MakeBinary_msvc_pch_path(chaz_MakeBinary *self);
+
+/** Return the compile flags for objects of a binary as make variable
+ * references and extra flags.
+ */
+static char*
+S_chaz_MakeBinary_obj_cflags(chaz_MakeBinary *self);
+
+/** Return a list of the objects compiled from sources, including unity
+ * batches, separated by space.
+ */
+static char*
+S_chaz_MakeBinary_src_obj_string(chaz_MakeBinary *self);
+
+/** Write the rule to build the precompiled header and make all objects
+ * depend on it.
+ */
+static void
+S_chaz_MakeFile_write_pch_rules(chaz_MakeBinary *binary, FILE *out);
+
+/** Generate the C files for unity batches and replace the objects in the
+ * object variable.
+ */
+static void
+S_chaz_MakeFile_prepare_unity_batches(chaz_MakeFile *self,
+                                      chaz_MakeBinary *binary);
+
+/** Write the rules to compile unity batches.
+ */
+static void
+S_chaz_MakeFile_write_unity_rules(chaz_MakeBinary *binary, FILE *out);
+
 /** Return the path to the object file for a source file.
  *
  * @param path The path to the source file.
@@ -155,10 +626,17 @@ S_chaz_MakeBinary_obj_path(const char *src_path);
 
 void
 chaz_Make_init(chaz_CLI *cli) {
-    const char *make_command = chaz_CLI_strval(cli, "make");
+    chaz_Make.cli           = cli;
+    chaz_Make.shell_type    = chaz_OS_shell_type();
+    chaz_Make.make_detected = 0;
+}
 
-    chaz_Make.cli        = cli;
-    chaz_Make.shell_type = chaz_OS_shell_type();
+static void
+S_chaz_Make_detect_make(void) {
+    const char *make_command = chaz_CLI_strval(chaz_Make.cli, "make");
+
+    if (chaz_Make.make_detected) { return; }
+    chaz_Make.make_detected = 1;
 
     if (make_command) {
         if (!S_chaz_Make_detect(make_command, NULL)) {
@@ -197,6 +675,7 @@ chaz_Make_clean_up(void) {
 
 const char*
 chaz_Make_get_make(void) {
+    S_chaz_Make_detect_make();
     return chaz_Make.make_command;
 }
 
@@ -291,6 +770,12 @@ chaz_MakeFile_new() {
     generated = chaz_Util_join("", "charmonizer", chaz_OS_exe_ext(),
                                " charmonizer.obj charmony.h Makefile", NULL);
     chaz_MakeRule_add_rm_command(self->distclean, generated);
+    if (chaz_Make.cli && chaz_CLI_defined(chaz_Make.cli, "split-charmony")) {
+        chaz_MakeRule_add_recursive_rm_command(self->distclean, "charmony");
+    }
+    if (chaz_Make.cli && chaz_CLI_defined(chaz_Make.cli, "build-variants")) {
+        chaz_MakeFile_add_default_variants(self);
+    }
 
     free(generated);
     return self;
@@ -303,7 +788,7 @@ chaz_MakeFile_destroy(chaz_MakeFile *self) {
     for (i = 0; self->vars[i]; i++) {
         chaz_MakeVar *var = self->vars[i];
         free(var->name);
-        free(var->value);
+        chaz_Buf_clear(&var->value);
         free(var);
     }
     free(self->vars);
@@ -326,6 +811,16 @@ chaz_MakeFile_destroy(chaz_MakeFile *self) {
     S_chaz_MakeRule_destroy(self->install);
     S_chaz_MakeRule_destroy(self->clean);
     S_chaz_MakeRule_destroy(self->distclean);
+    for (i = 0; i < self->num_variants; i++) {
+        free(self->variant_names[i]);
+        chaz_CFlags_destroy(self->variant_cflags[i]);
+    }
+    free(self->variant_names);
+    free(self->variant_cflags);
+
+    if (self->pgo_train) {
+        S_chaz_MakeRule_destroy(self->pgo_train);
+    }
 
     free(self);
 }
@@ -338,8 +833,9 @@ chaz_MakeFile_add_var(chaz_MakeFile *self, const char *name,
     size_t         num_vars = self->num_vars + 1;
 
     var->name         = chaz_Util_strdup(name);
-    var->value        = chaz_Util_strdup("");
     var->num_elements = 0;
+    chaz_Buf_init(&var->value);
+    chaz_Buf_append(&var->value, "");
 
     if (value) { chaz_MakeVar_append(var, value); }
 
@@ -385,22 +881,237 @@ chaz_MakeFile_distclean_rule(chaz_MakeFile *self) {
     return self->distclean;
 }
 
+void
+chaz_MakeFile_merge(chaz_MakeFile *self, chaz_MakeFile *other) {
+    size_t i, j;
+
+    if (self->finalized || other->finalized) {
+        chaz_Util_die("Can't merge MakeFile after it was written");
+    }
+
+    /* Move variables. */
+    for (i = 0; other->vars[i]; i++) {
+        chaz_MakeVar *var = other->vars[i];
+        for (j = 0; self->vars[j]; j++) {
+            if (strcmp(self->vars[j]->name, var->name) == 0) {
+                chaz_Util_die("Make variable '%s' defined twice", var->name);
+            }
+        }
+    }
+    self->vars = (chaz_MakeVar**)realloc(
+        self->vars,
+        (self->num_vars + other->num_vars + 1) * sizeof(chaz_MakeVar*));
+    for (i = 0; other->vars[i]; i++) {
+        self->vars[self->num_vars++] = other->vars[i];
+    }
+    self->vars[self->num_vars] = NULL;
+
+    /* Move rules. Rules for the same targets are combined like make does,
+     * but only one of them may have commands. */
+    self->rules = (chaz_MakeRule**)realloc(
+        self->rules,
+        (self->num_rules + other->num_rules + 1) * sizeof(chaz_MakeRule*));
+    for (i = 0; other->rules[i]; i++) {
+        chaz_MakeRule *rule = other->rules[i];
+        chaz_MakeRule *dupe = S_chaz_MakeFile_find_rule(self, rule);
+
+        if (dupe == NULL) {
+            self->rules[self->num_rules++] = rule;
+            self->rules[self->num_rules]   = NULL;
+            continue;
+        }
+        if (dupe->commands.ptr && rule->commands.ptr) {
+            chaz_Util_die("Commands for make target '%s' defined twice",
+                          rule->targets.ptr);
+        }
+        if (rule->prereqs.ptr) {
+            chaz_MakeRule_add_prereq(dupe, rule->prereqs.ptr);
+        }
+        if (rule->commands.ptr) {
+            chaz_Buf_append(&dupe->commands, rule->commands.ptr);
+        }
+        S_chaz_MakeRule_destroy(rule);
+    }
+    self->rules[self->num_rules] = NULL;
+
+    /* Move binaries. */
+    self->binaries = (chaz_MakeBinary**)realloc(
+        self->binaries,
+        (self->num_binaries + other->num_binaries + 1)
+        * sizeof(chaz_MakeBinary*));
+    for (i = 0; other->binaries[i]; i++) {
+        self->binaries[self->num_binaries++] = other->binaries[i];
+    }
+    self->binaries[self->num_binaries] = NULL;
+
+    for (i = 0; other->install_dirs[i]; i++) {
+        S_chaz_MakeFile_add_install_dir(self, other->install_dirs[i]);
+        free(other->install_dirs[i]);
+    }
+
+    /* Merge the commands of the standard targets. Commands to remove
+     * files are only added once. */
+    S_chaz_MakeRule_merge_commands(self->install, other->install, 0);
+    S_chaz_MakeRule_merge_commands(self->clean, other->clean, 1);
+    S_chaz_MakeRule_merge_commands(self->distclean, other->distclean, 1);
+    if (other->pgo_train) {
+        if (self->pgo_train == NULL) {
+            self->pgo_train = S_chaz_MakeRule_new("pgo-train",
+                                                  "pgo-generate");
+        }
+        S_chaz_MakeRule_merge_commands(self->pgo_train, other->pgo_train, 0);
+        S_chaz_MakeRule_destroy(other->pgo_train);
+    }
+
+    /* Move variants. Variants with the same name, like the defaults added
+     * to every MakeFile, must have the same flags. */
+    for (i = 0; i < other->num_variants; i++) {
+        char        *name   = other->variant_names[i];
+        chaz_CFlags *cflags = other->variant_cflags[i];
+        size_t       j;
+
+        for (j = 0; j < self->num_variants; j++) {
+            if (strcmp(self->variant_names[j], name) == 0) { break; }
+        }
+        if (j < self->num_variants) {
+            if (strcmp(chaz_CFlags_get_string(self->variant_cflags[j]),
+                       chaz_CFlags_get_string(cflags)) != 0
+               ) {
+                chaz_Util_die("Build variant '%s' defined twice", name);
+            }
+            free(name);
+            chaz_CFlags_destroy(cflags);
+        }
+        else {
+            size_t alloc_size = (self->num_variants + 1) * sizeof(char*);
+            self->variant_names
+                = (char**)realloc(self->variant_names, alloc_size);
+            alloc_size = (self->num_variants + 1) * sizeof(chaz_CFlags*);
+            self->variant_cflags
+                = (chaz_CFlags**)realloc(self->variant_cflags, alloc_size);
+            self->variant_names[self->num_variants]  = name;
+            self->variant_cflags[self->num_variants] = cflags;
+            self->num_variants++;
+        }
+    }
+
+    S_chaz_MakeRule_destroy(other->install);
+    S_chaz_MakeRule_destroy(other->clean);
+    S_chaz_MakeRule_destroy(other->distclean);
+    free(other->install_dirs);
+    free(other->variant_names);
+    free(other->variant_cflags);
+    free(other->binaries);
+    free(other->rules);
+    free(other->vars);
+    free(other);
+}
+
+static chaz_MakeRule*
+S_chaz_MakeFile_find_rule(chaz_MakeFile *self, chaz_MakeRule *rule) {
+    size_t i;
+
+    for (i = 0; self->rules[i]; i++) {
+        chaz_MakeRule *candidate = self->rules[i];
+        char *common = S_chaz_Make_common_word(candidate->targets.ptr,
+                                               rule->targets.ptr);
+
+        if (common == NULL) { continue; }
+        if (strcmp(candidate->targets.ptr, rule->targets.ptr) != 0) {
+            chaz_Util_die("Make target '%s' defined twice", common);
+        }
+        free(common);
+        return candidate;
+    }
+
+    return NULL;
+}
+
+static char*
+S_chaz_Make_common_word(const char *words1, const char *words2) {
+    const char *p = words2;
+
+    if (words1 == NULL || words2 == NULL) { return NULL; }
+
+    while (*p) {
+        const char *end;
+        const char *q = words1;
+        size_t      len;
+
+        while (*p == ' ') { p++; }
+        for (end = p; *end && *end != ' '; end++) {}
+        len = (size_t)(end - p);
+
+        while (len > 0 && *q) {
+            const char *q_end;
+
+            while (*q == ' ') { q++; }
+            for (q_end = q; *q_end && *q_end != ' '; q_end++) {}
+            if ((size_t)(q_end - q) == len && memcmp(p, q, len) == 0) {
+                char *word = (char*)malloc(len + 1);
+                memcpy(word, p, len);
+                word[len] = '\0';
+                return word;
+            }
+            q = q_end;
+        }
+
+        p = end;
+    }
+
+    return NULL;
+}
+
+static void
+S_chaz_MakeRule_merge_commands(chaz_MakeRule *self, chaz_MakeRule *other,
+                               int unique) {
+    const char *line = other->commands.ptr;
+
+    if (line == NULL) { return; }
+
+    while (*line) {
+        const char *end  = strchr(line, '\n');
+        size_t      len  = end ? (size_t)(end - line) + 1 : strlen(line);
+        char       *copy = (char*)malloc(len + 2);
+        int         skip = 0;
+
+        /* Prepend a newline to match complete lines. */
+        copy[0] = '\n';
+        memcpy(copy + 1, line, len);
+        copy[len+1] = '\0';
+
+        if (unique && self->commands.ptr) {
+            skip = strncmp(self->commands.ptr, copy + 1, len) == 0
+                   || strstr(self->commands.ptr, copy) != NULL;
+        }
+        if (!skip) {
+            chaz_Buf_append_len(&self->commands, copy + 1, len);
+        }
+
+        free(copy);
+        line += len;
+    }
+}
+
 chaz_MakeBinary*
 chaz_MakeFile_add_exe(chaz_MakeFile *self, const char *dir,
                       const char *basename, int installed) {
     const char *exe_ext = chaz_CC_exe_ext();
+    char *build_dir = chaz_Make_build_dir(dir);
     char *target;
     char *command;
     chaz_MakeBinary *binary;
     chaz_CFlags *ldflags;
 
-    if (dir == NULL || strcmp(dir, ".") == 0) {
+    if (strcmp(build_dir, ".") == 0) {
         target = chaz_Util_join("", basename, exe_ext, NULL);
     }
     else {
         const char *dir_sep = chaz_OS_dir_sep();
-        target = chaz_Util_join("", dir, dir_sep, basename, exe_ext, NULL);
+        target = chaz_Util_join("", build_dir, dir_sep, basename, exe_ext,
+                                NULL);
     }
+    free(build_dir);
 
     binary = S_chaz_MakeFile_add_binary(self, CHAZ_MAKEBINARY_EXE, basename,
                                         target);
@@ -432,20 +1143,24 @@ chaz_MakeFile_add_shared_lib(chaz_MakeFile *self, const char *dir,
                              const char *basename, const char *version,
                              const char *major_version, int installed) {
     int binfmt = chaz_CC_binary_format();
+    char *build_dir = chaz_Make_build_dir(dir);
     char *path, *vpath, *mpath;
     char *command;
     chaz_MakeBinary *binary;
     chaz_CFlags *ldflags;
 
-    path = chaz_CC_shared_lib_filename(dir, basename, NULL);
+    path = chaz_CC_shared_lib_filename(build_dir, basename, NULL);
     if (binfmt == CHAZ_CC_BINFMT_PE) {
-        vpath = chaz_CC_shared_lib_filename(dir, basename, major_version);
+        vpath = chaz_CC_shared_lib_filename(build_dir, basename,
+                                            major_version);
         mpath = NULL;
     }
     else {
-        vpath = chaz_CC_shared_lib_filename(dir, basename, version);
-        mpath = chaz_CC_shared_lib_filename(dir, basename, major_version);
+        vpath = chaz_CC_shared_lib_filename(build_dir, basename, version);
+        mpath = chaz_CC_shared_lib_filename(build_dir, basename,
+                                            major_version);
     }
+    free(build_dir);
 
     binary = S_chaz_MakeFile_add_binary(self, CHAZ_MAKEBINARY_SHARED_LIB,
                                         basename, vpath);
@@ -556,20 +1271,39 @@ chaz_MakeFile_add_shared_lib(chaz_MakeFile *self, const char *dir,
 chaz_MakeBinary*
 chaz_MakeFile_add_static_lib(chaz_MakeFile *self, const char *dir,
                              const char *basename, int installed) {
-    char *target = chaz_CC_static_lib_filename(dir, basename);
-    char *command;
+    char *build_dir = chaz_Make_build_dir(dir);
+    char *target = chaz_CC_static_lib_filename(build_dir, basename);
     chaz_MakeBinary *binary
         = S_chaz_MakeFile_add_binary(self, CHAZ_MAKEBINARY_STATIC_LIB,
                                      basename, target);
 
-    command = chaz_CC_format_archiver_command("$@", binary->obj_dollar_var);
-    chaz_MakeRule_add_command(binary->rule, command);
+    free(build_dir);
+
+    S_chaz_MakeBinary_set_archiver_command(binary);
 
     if (installed) {
+        binary->installed = 1;
         chaz_MakeFile_install(self, target, "$(LIBDIR)", NULL);
     }
 
-    free(command);
+    free(target);
+    return binary;
+}
+
+chaz_MakeBinary*
+chaz_MakeFile_add_object_group(chaz_MakeFile *self, const char *basename) {
+    char *target = chaz_Util_join("", basename, "_group", NULL);
+    chaz_MakeBinary *binary;
+    size_t i;
+
+    for (i = 0; target[i] != '\0'; i++) {
+        target[i] = tolower((unsigned char)target[i]);
+    }
+
+    /* The target is a phony rule that builds all objects. */
+    binary = S_chaz_MakeFile_add_binary(self, CHAZ_MAKEBINARY_OBJECT_GROUP,
+                                        basename, target);
+
     free(target);
     return binary;
 }
@@ -595,6 +1329,7 @@ S_chaz_MakeFile_add_binary(chaz_MakeFile *self, int type, const char *basename,
         case CHAZ_MAKEBINARY_EXE:        suffix = "EXE";        break;
         case CHAZ_MAKEBINARY_STATIC_LIB: suffix = "STATIC_LIB"; break;
         case CHAZ_MAKEBINARY_SHARED_LIB: suffix = "SHARED_LIB"; break;
+        case CHAZ_MAKEBINARY_OBJECT_GROUP: suffix = "GROUP";    break;
         default:
             chaz_Util_die("Unknown binary type %d", type);
             return NULL;
@@ -612,11 +1347,14 @@ S_chaz_MakeFile_add_binary(chaz_MakeFile *self, int type, const char *basename,
 
     chaz_MakeFile_add_var(self, binary_var_name, target);
 
+    binary->type           = type;
     binary->rule           = S_chaz_MakeRule_new(target, obj_dollar_var);
     binary->obj_var        = chaz_MakeFile_add_var(self, obj_var_name, NULL);
     binary->obj_dollar_var = obj_dollar_var;
     binary->sources        = (char**)calloc(1, sizeof(char*));
     binary->single_sources = (char**)calloc(1, sizeof(char*));
+    binary->flagged_sources = (char**)calloc(1, sizeof(char*));
+    binary->flagged_cflags  = (char**)calloc(1, sizeof(char*));
     binary->dirs           = (char**)calloc(1, sizeof(char*));
 
     binary->cflags_var  = chaz_MakeFile_add_var(self, cflags_var_name, NULL);
@@ -625,7 +1363,9 @@ S_chaz_MakeFile_add_binary(chaz_MakeFile *self, int type, const char *basename,
     binary->ldflags     = chaz_CC_new_cflags();
 
     chaz_MakeRule_add_rm_command(self->clean, obj_dollar_var);
-    chaz_MakeRule_add_rm_command(self->clean, target);
+    if (type != CHAZ_MAKEBINARY_OBJECT_GROUP) {
+        chaz_MakeRule_add_rm_command(self->clean, target);
+    }
 
     num_binaries = self->num_binaries;
     alloc_size   = (num_binaries + 2) * sizeof(chaz_MakeBinary*);
@@ -817,38 +1557,102 @@ S_chaz_MakeFile_add_install_dir(chaz_MakeFile *self, const char *dir) {
 
 void
 chaz_MakeFile_write(chaz_MakeFile *self) {
-    FILE   *out;
-    size_t  i;
-
-    out = fopen("Makefile", "w");
-    if (!out) {
-        chaz_Util_die("Can't open Makefile\n");
+    FILE          *out;
+    chaz_MakeRule *report;
+    char          *command;
+    char          *launcher;
+    const char    *timer = "";
+    size_t         i;
+
+    /* Pattern rule support depends on the make utility. */
+    S_chaz_Make_detect_make();
+
+    if (chaz_CLI_defined(chaz_Make.cli, "enable-ninja")) {
+        chaz_MakeRule_add_rm_command(self->distclean,
+                                     "build.ninja .ninja_deps .ninja_log");
     }
 
+    out = chaz_Util_open_updated_file("Makefile");
+
     if (chaz_Make.shell_type == CHAZ_OS_CMD_EXE) {
         /* Make sure that mingw32-make uses the cmd.exe shell. */
         fprintf(out, "SHELL = cmd\n");
     }
 
-    fprintf(out, "CC = %s\n", chaz_CC_get_cc());
-    fprintf(out, "LINK = %s\n", chaz_CC_link_command());
+    /* Profile-guided optimization is only supported with GCC and Clang.
+     * PGO_CFLAGS is set by recursive make invocations and used for both
+     * compiling and linking. */
+    chaz_Make.pgo = 0;
+    if (self->pgo_train) {
+        if (chaz_CC_is_gcc()) {
+            chaz_Make.pgo = 1;
+        }
+        else {
+            chaz_Util_warn("Profile-guided optimization isn't supported"
+                           " with '%s'", chaz_CC_get_cc());
+        }
+    }
 
-    S_chaz_MakeFile_write_install_vars(out);
+    if (S_chaz_Make_builddir()) {
+        fprintf(out, "BUILDDIR = %s\n", S_chaz_Make_builddir());
+    }
+    fprintf(out, "CC = %s\n", chaz_CC_get_cc());
+    /* Time link commands by wrapping LINK. Archiver commands aren't
+     * timed. */
+    if (S_chaz_Make_build_timing()) {
+        char *value = S_chaz_Make_build_timer_var();
+        fprintf(out, "BUILD_TIMER = %s\n", value);
+        free(value);
+        timer = "$(BUILD_TIMER) $@ ";
+    }
+    fprintf(out, "LINK = %s%s", timer, chaz_CC_link_command());
+    if (chaz_Make.pgo) {
+        fprintf(out, " $(PGO_CFLAGS)");
+    }
+    /* VARIANT_CFLAGS is set by the recursive make invocations of build
+     * variants. */
+    if (chaz_Make.variants) {
+        fprintf(out, " $(VARIANT_CFLAGS)");
+    }
+    fprintf(out, "\n");
+    if (chaz_Make.pgo) {
+        fprintf(out, "PGO_DIR = pgo-data\n");
+        fprintf(out, "PGO_CFLAGS =\n");
+    }
+    if (chaz_Make.variants) {
+        fprintf(out, "VARIANT_CFLAGS =\n");
+    }
 
-    /* Finalize binary vars. */
-    for (i = 0; self->binaries[i]; i++) {
-        chaz_MakeBinary *binary = self->binaries[i];
-        const char *flags;
+    /* Compiler launchers like ccache only wrap compile commands. */
+    launcher = S_chaz_Make_compiler_launcher();
+    chaz_Make.launcher = launcher != NULL;
+    if (launcher) {
+        fprintf(out, "CC_LAUNCHER = %s\n", launcher);
+        free(launcher);
+    }
 
-        flags = chaz_CFlags_get_string(binary->cflags);
-        chaz_MakeVar_append(binary->cflags_var, flags);
-        flags = chaz_CFlags_get_string(binary->ldflags);
-        chaz_MakeVar_append(binary->ldflags_var, flags);
+    /* Track header dependencies with dependency files generated by the
+     * compiler. This requires a make utility that supports '-include'
+     * which we assume for make utilities that support pattern rules.
+     */
+    chaz_Make.dep_files = 0;
+    if (chaz_Make.supports_pattern_rules) {
+        chaz_CFlags *dep_flags = chaz_CC_new_cflags();
+        if (chaz_CFlags_generate_dep_files(dep_flags)) {
+            fprintf(out, "DEPFLAGS = %s\n",
+                    chaz_CFlags_get_string(dep_flags));
+            chaz_Make.dep_files = 1;
+        }
+        chaz_CFlags_destroy(dep_flags);
     }
 
+    S_chaz_MakeFile_write_install_vars(out);
+
+    S_chaz_MakeFile_finalize(self);
+
     for (i = 0; self->vars[i]; i++) {
         chaz_MakeVar *var = self->vars[i];
-        fprintf(out, "%s = %s\n", var->name, var->value);
+        fprintf(out, "%s = %s\n", var->name, var->value.ptr);
     }
     fprintf(out, "\n");
 
@@ -860,21 +1664,40 @@ chaz_MakeFile_write(chaz_MakeFile *self) {
         S_chaz_MakeFile_write_binary_rules(self->binaries[i], out);
     }
 
-    if (self->num_install_dirs) {
-        /* Prepend mkdir commands. */
-        chaz_MakeRule *dummy = S_chaz_MakeRule_new(NULL, NULL);
-        char *commands;
-
-        for (i = 0; self->install_dirs[i]; i++) {
-            chaz_MakeRule_add_mkdir_command(dummy, self->install_dirs[i]);
+    if (chaz_Make.dep_files) {
+        for (i = 0; self->binaries[i]; i++) {
+            chaz_MakeBinary *binary = self->binaries[i];
+            char *dep_files
+                = chaz_Util_join("", "$(", binary->obj_var->name, ":",
+                                 chaz_CC_obj_ext(), "=.d)", NULL);
+            fprintf(out, "-include %s\n", dep_files);
+            chaz_MakeRule_add_rm_command(self->clean, dep_files);
+            free(dep_files);
+
+            if (binary->pch_file) {
+                /* header.h.gch -> header.h.d */
+                char *dep_file = chaz_Util_strdup(binary->pch_file);
+                strcpy(strrchr(dep_file, '.'), ".d");
+                fprintf(out, "-include %s\n", dep_file);
+                chaz_MakeRule_add_rm_command(self->clean, dep_file);
+                free(dep_file);
+            }
         }
+        fprintf(out, "\n");
+    }
+
+    if (chaz_Make.pgo) {
+        S_chaz_MakeFile_write_pgo_rules(self, out);
+    }
 
-        commands = chaz_Util_join("", dummy->commands, self->install->commands,
-                                  NULL);
-        free(self->install->commands);
-        self->install->commands = commands;
+    if (self->num_variants > 0) {
+        S_chaz_MakeFile_write_variant_rules(self, out);
+    }
 
-        S_chaz_MakeRule_destroy(dummy);
+    report = S_chaz_Make_build_report_rule();
+    if (report) {
+        S_chaz_MakeRule_write(report, out);
+        S_chaz_MakeRule_destroy(report);
     }
 
     S_chaz_MakeRule_write(self->install, out);
@@ -882,74 +1705,109 @@ chaz_MakeFile_write(chaz_MakeFile *self) {
     S_chaz_MakeRule_write(self->distclean, out);
 
     /* Suffix rule for .c files. */
-    if (chaz_CC_is_msvc()) {
-        fprintf(out, ".c.obj :\n");
-        fprintf(out, "\t$(CC) /nologo $(CFLAGS) /c $< /Fo$@\n\n");
-    }
-    else {
-        fprintf(out, ".c.o :\n");
-        fprintf(out, "\t$(CC) $(CFLAGS) -c $< -o $@\n\n");
-    }
+    command = S_chaz_MakeFile_compile_command(NULL, "$<");
+    fprintf(out, ".c%s :\n", chaz_CC_obj_ext());
+    fprintf(out, "\t%s\n\n", command);
+    free(command);
 
-    fclose(out);
+    chaz_Util_close_updated_file(out, "Makefile");
+
+    if (chaz_CLI_defined(chaz_Make.cli, "enable-ninja")) {
+        S_chaz_MakeFile_do_write_ninja(self);
+    }
 }
 
 static void
 S_chaz_MakeFile_write_install_vars(FILE *out) {
-    const char *dir_sep = chaz_OS_dir_sep();
-    const char *strval;
-
-    strval = chaz_CLI_strval(chaz_Make.cli, "prefix");
-    fprintf(out, "PREFIX = %s\n", strval ? strval : "/usr/local");
+    static const char *const names[] = {
+        "PREFIX", "BINDIR", "DATAROOTDIR", "DATADIR", "LIBDIR", "MANDIR",
+        NULL
+    };
+    size_t i;
 
-    strval = chaz_CLI_strval(chaz_Make.cli, "bindir");
-    if (strval) {
-        fprintf(out, "BINDIR = %s\n", strval);
-    }
-    else {
-        fprintf(out, "BINDIR = $(PREFIX)%sbin\n", dir_sep);
+    for (i = 0; names[i]; i++) {
+        char *value = S_chaz_Make_install_var(names[i]);
+        fprintf(out, "%s = %s\n", names[i], value);
+        free(value);
     }
+}
 
-    strval = chaz_CLI_strval(chaz_Make.cli, "datarootdir");
-    if (strval) {
-        fprintf(out, "DATAROOTDIR = %s\n", strval);
-    }
-    else {
-        fprintf(out, "DATAROOTDIR = $(PREFIX)%sshare\n", dir_sep);
+static char*
+S_chaz_Make_install_var(const char *name) {
+    const char *dir_sep = chaz_OS_dir_sep();
+    const char *option;
+    const char *strval;
+
+    if (strcmp(name, "PREFIX") == 0) {
+        strval = chaz_CLI_strval(chaz_Make.cli, "prefix");
+        return chaz_Util_strdup(strval ? strval : "/usr/local");
     }
 
-    strval = chaz_CLI_strval(chaz_Make.cli, "datadir");
-    fprintf(out, "DATADIR = %s\n", strval ? strval : "$(DATAROOTDIR)");
+    if (strcmp(name, "BINDIR") == 0)           { option = "bindir"; }
+    else if (strcmp(name, "DATAROOTDIR") == 0) { option = "datarootdir"; }
+    else if (strcmp(name, "DATADIR") == 0)     { option = "datadir"; }
+    else if (strcmp(name, "LIBDIR") == 0)      { option = "libdir"; }
+    else if (strcmp(name, "MANDIR") == 0)      { option = "mandir"; }
+    else                                       { return NULL; }
 
-    strval = chaz_CLI_strval(chaz_Make.cli, "libdir");
+    strval = chaz_CLI_strval(chaz_Make.cli, option);
     if (strval) {
-        fprintf(out, "LIBDIR = %s\n", strval);
-    }
-    else {
-        fprintf(out, "LIBDIR = $(PREFIX)%slib\n", dir_sep);
+        return chaz_Util_strdup(strval);
     }
 
-    strval = chaz_CLI_strval(chaz_Make.cli, "mandir");
-    if (strval) {
-        fprintf(out, "MANDIR = %s\n", strval);
+    if (strcmp(name, "BINDIR") == 0) {
+        return chaz_Util_join(dir_sep, "$(PREFIX)", "bin", NULL);
     }
-    else {
-        fprintf(out, "MANDIR = $(DATAROOTDIR)%sman\n", dir_sep);
+    if (strcmp(name, "DATAROOTDIR") == 0) {
+        return chaz_Util_join(dir_sep, "$(PREFIX)", "share", NULL);
+    }
+    if (strcmp(name, "DATADIR") == 0) {
+        return chaz_Util_strdup("$(DATAROOTDIR)");
     }
+    if (strcmp(name, "LIBDIR") == 0) {
+        return chaz_Util_join(dir_sep, "$(PREFIX)", "lib", NULL);
+    }
+    return chaz_Util_join(dir_sep, "$(DATAROOTDIR)", "man", NULL);
 }
 
 static void
 S_chaz_MakeFile_write_binary_rules(chaz_MakeBinary *binary, FILE *out) {
     const char *cflags_string;
 
-    S_chaz_MakeRule_write(binary->rule, out);
+    if (S_chaz_Make_builddir()
+        && binary->type != CHAZ_MAKEBINARY_OBJECT_GROUP
+       ) {
+        /* Create the output directory before running the commands. */
+        chaz_MakeRule *rule = S_chaz_MakeRule_new(binary->rule->targets.ptr,
+                                                  binary->rule->prereqs.ptr);
+
+        chaz_MakeRule_add_mkdir_command(rule, "$(@D)");
+        if (binary->rule->commands.ptr) {
+            chaz_Buf_append(&rule->commands, binary->rule->commands.ptr);
+        }
+        S_chaz_MakeRule_write(rule, out);
+        S_chaz_MakeRule_destroy(rule);
+    }
+    else {
+        S_chaz_MakeRule_write(binary->rule, out);
+    }
+
+    if (binary->num_unity_batches > 0) {
+        S_chaz_MakeFile_write_unity_rules(binary, out);
+    }
+
+    if (binary->pch_file) {
+        S_chaz_MakeFile_write_pch_rules(binary, out);
+    }
 
     cflags_string = chaz_CFlags_get_string(binary->cflags);
 
-    /* Write rules to compile with custom flags. */
-    if (cflags_string[0] != '\0') {
-        char *dollar_var = chaz_Util_join("", "$(", binary->cflags_var->name,
-                                          ")", NULL);
+    /* Write rules to compile with custom flags. Objects in a build
+     * directory can't be built with the suffix rule. */
+    if (cflags_string[0] != '\0' || binary->pch_file
+        || S_chaz_Make_builddir()
+       ) {
+        char *dollar_var = S_chaz_MakeBinary_obj_cflags(binary);
 
         if (!chaz_Make.supports_pattern_rules
             || chaz_Make.shell_type == CHAZ_OS_CMD_EXE) {
@@ -958,111 +1816,1422 @@ S_chaz_MakeFile_write_binary_rules(chaz_MakeBinary *binary, FILE *out) {
              * mingw32-make which has problems with pattern rules and
              * backslash directory separators.
              */
-            S_chaz_MakeFile_write_object_rules(binary->sources, dollar_var,
-                                               out);
+            S_chaz_MakeFile_write_object_rules(binary, binary->sources,
+                                               dollar_var, out);
         }
         else {
             /* Write a pattern rule for each directory. */
             S_chaz_MakeFile_write_pattern_rules(binary->dirs, dollar_var, out);
             /* Write a rule for each object added with add_src_file. */
-            S_chaz_MakeFile_write_object_rules(binary->single_sources,
+            S_chaz_MakeFile_write_object_rules(binary, binary->single_sources,
                                                dollar_var, out);
         }
 
         free(dollar_var);
     }
+
+    /* Explicit rules take precedence over the pattern rules, so these
+     * also work for sources in a source directory. */
+    S_chaz_MakeFile_write_flagged_object_rules(binary, out);
 }
 
 static void
-S_chaz_MakeFile_write_object_rules(char **sources, const char *cflags,
-                                   FILE *out) {
-    const char *cc = chaz_CC_is_msvc() ? "$(CC) /nologo" : "$(CC)";
-    chaz_CFlags *output_cflags = chaz_CC_new_cflags();
-    const char *output_cflags_string;
+S_chaz_MakeFile_write_object_rules(chaz_MakeBinary *binary, char **sources,
+                                   const char *cflags, FILE *out) {
     size_t i;
 
-    chaz_CFlags_set_output_obj(output_cflags, "$@");
-    output_cflags_string = chaz_CFlags_get_string(output_cflags);
-
     for (i = 0; sources[i]; i++) {
-        const char *source = sources[i];
-        char *obj_path = S_chaz_MakeBinary_obj_path(source);
-        chaz_MakeRule *rule;
-        char *command;
+        if (S_chaz_MakeBinary_flagged_index(binary, sources[i]) >= 0) {
+            continue;
+        }
+        S_chaz_MakeFile_write_object_rule(sources[i], cflags, out);
+    }
+}
 
-        if (obj_path == NULL) { continue; }
+static void
+S_chaz_MakeFile_write_flagged_object_rules(chaz_MakeBinary *binary,
+                                           FILE *out) {
+    size_t i;
+
+    for (i = 0; i < binary->num_flagged_sources; i++) {
+        char *cflags = S_chaz_MakeBinary_flagged_cflags(binary, (int)i);
+        S_chaz_MakeFile_write_object_rule(binary->flagged_sources[i], cflags,
+                                          out);
+        free(cflags);
+    }
+}
+
+static void
+S_chaz_MakeFile_write_object_rule(const char *source, const char *cflags,
+                                  FILE *out) {
+    char *obj_path = S_chaz_MakeBinary_obj_path(source);
+    chaz_MakeRule *rule;
+    char *command;
+
+    if (obj_path == NULL) { return; }
+
+    rule = S_chaz_MakeRule_new(obj_path, source);
+    if (S_chaz_Make_builddir()) {
+        chaz_MakeRule_add_mkdir_command(rule, "$(@D)");
+    }
+    command = S_chaz_MakeFile_compile_command(cflags, source);
+    chaz_MakeRule_add_command(rule, command);
+    S_chaz_MakeRule_write(rule, out);
+
+    free(command);
+    S_chaz_MakeRule_destroy(rule);
+    free(obj_path);
+}
+
+static void
+S_chaz_MakeFile_write_pattern_rules(char **dirs, const char *cflags,
+                                    FILE *out) {
+    const char *obj_ext = chaz_CC_obj_ext();
+    const char *dir_sep = chaz_OS_dir_sep();
+    char *command = S_chaz_MakeFile_compile_command(cflags, "$<");
+    size_t i;
 
-        rule = S_chaz_MakeRule_new(obj_path, source);
-        command = chaz_Util_join(" ", cc, "$(CFLAGS)", cflags, source,
-                                 output_cflags_string, NULL);
+    for (i = 0; dirs[i]; i++) {
+        const char *dir = dirs[i];
+        char *obj_dir = chaz_Make_build_dir(dir);
+        char *target = chaz_Util_join("", obj_dir, dir_sep, "%", obj_ext,
+                                      NULL);
+        char *prereq = chaz_Util_join("", dir, dir_sep, "%.c", NULL);
+        chaz_MakeRule *rule = S_chaz_MakeRule_new(target, prereq);
+
+        if (S_chaz_Make_builddir()) {
+            chaz_MakeRule_add_mkdir_command(rule, "$(@D)");
+        }
+        chaz_MakeRule_add_command(rule, command);
+        S_chaz_MakeRule_write(rule, out);
+
+        S_chaz_MakeRule_destroy(rule);
+        free(prereq);
+        free(target);
+        free(obj_dir);
+    }
+
+    free(command);
+}
+
+static void
+S_chaz_MakeFile_prepare_unity_batches(chaz_MakeFile *self,
+                                      chaz_MakeBinary *binary) {
+    char   *obj_string = S_chaz_MakeBinary_src_obj_string(binary);
+    char   *obj;
+    int    *batches;
+    int     num_batches;
+    int     i;
+    size_t  j;
+
+    /* Generate a C file for every batch. */
+    batches = S_chaz_MakeBinary_unity_batches(binary, &num_batches);
+    for (i = 0; i < num_batches; i++) {
+        char     *path = S_chaz_MakeBinary_unity_path(binary, i);
+        chaz_Buf  content;
+
+        chaz_Buf_init(&content);
+        chaz_Buf_append(&content,
+            "/* Unity batch generated by Charmonizer. Do not edit. */\n");
+        for (j = 0; j < binary->num_sources; j++) {
+            if (batches[j] != i) { continue; }
+            chaz_Buf_append(&content, "#include \"");
+            chaz_Buf_append(&content, binary->sources[j]);
+            chaz_Buf_append(&content, "\"\n");
+        }
+
+        chaz_Util_update_file(path, content.ptr);
+        chaz_MakeRule_add_rm_command(self->distclean, path);
+
+        chaz_Buf_clear(&content);
+        free(path);
+    }
+    free(batches);
+
+    /* Replace the objects in the object variable. */
+    binary->obj_var->value.len    = 0;
+    binary->obj_var->value.ptr[0] = '\0';
+    binary->obj_var->num_elements = 0;
+    for (obj = strtok(obj_string, " "); obj; obj = strtok(NULL, " ")) {
+        chaz_MakeVar_append(binary->obj_var, obj);
+    }
+
+    free(obj_string);
+}
+
+static void
+S_chaz_MakeFile_write_unity_rules(chaz_MakeBinary *binary, FILE *out) {
+    char *dollar_var = S_chaz_MakeBinary_obj_cflags(binary);
+    int  *batches;
+    int   num_batches;
+    int   i;
+
+    batches = S_chaz_MakeBinary_unity_batches(binary, &num_batches);
+    for (i = 0; i < num_batches; i++) {
+        char          *path     = S_chaz_MakeBinary_unity_path(binary, i);
+        char          *obj_path = S_chaz_MakeBinary_obj_path(path);
+        chaz_MakeRule *rule     = S_chaz_MakeRule_new(obj_path, path);
+        char          *command;
+        size_t         j;
+
+        /* Rebuild the batch if any of the included sources changes. */
+        for (j = 0; j < binary->num_sources; j++) {
+            if (batches[j] == i) {
+                chaz_MakeRule_add_prereq(rule, binary->sources[j]);
+            }
+        }
+
+        if (S_chaz_Make_builddir()) {
+            chaz_MakeRule_add_mkdir_command(rule, "$(@D)");
+        }
+        command = S_chaz_MakeFile_compile_command(dollar_var, path);
         chaz_MakeRule_add_command(rule, command);
         S_chaz_MakeRule_write(rule, out);
 
         free(command);
         S_chaz_MakeRule_destroy(rule);
         free(obj_path);
+        free(path);
+    }
+
+    free(batches);
+    free(dollar_var);
+}
+
+static void
+S_chaz_MakeFile_write_pch_rules(chaz_MakeBinary *binary, FILE *out) {
+    char          *cflags = chaz_Util_join("", "$(", binary->cflags_var->name,
+                                           ")", NULL);
+    char          *obj_string;
+    char          *command;
+    chaz_MakeRule *rule;
+
+    if (chaz_CC_is_msvc()) {
+        /* The PCH is created as a side effect of compiling the stub. */
+        char *stub = S_chaz_MakeBinary_generated_path(binary, "_pch.c");
+        char *pch  = S_chaz_MakeBinary_msvc_pch_path(binary);
+        char *pch_cflags = chaz_Util_join("", cflags, " /Yc\"",
+                                          binary->pch_header, "\" /Fp", pch,
+                                          NULL);
+        rule = S_chaz_MakeRule_new(binary->pch_file, stub);
+        command = S_chaz_MakeFile_compile_command(pch_cflags, stub);
+        free(pch_cflags);
+        free(pch);
+        free(stub);
+    }
+    else {
+        char *pch_cflags = chaz_Util_join(" ", cflags, "-x c-header", NULL);
+        rule = S_chaz_MakeRule_new(binary->pch_file, NULL);
+        command = S_chaz_MakeFile_compile_command(pch_cflags,
+                                                  binary->pch_header);
+        free(pch_cflags);
+    }
+    chaz_MakeRule_add_prereq(rule, binary->pch_header);
+    if (S_chaz_Make_builddir()) {
+        chaz_MakeRule_add_mkdir_command(rule, "$(@D)");
+    }
+    chaz_MakeRule_add_command(rule, command);
+    S_chaz_MakeRule_write(rule, out);
+    S_chaz_MakeRule_destroy(rule);
+    free(command);
+
+    /* Make all other objects depend on the PCH. The objects are listed
+     * explicitly because the object variable contains the PCH object with
+     * MSVC. */
+    obj_string = S_chaz_MakeBinary_src_obj_string(binary);
+    if (obj_string[0] != '\0') {
+        rule = S_chaz_MakeRule_new(obj_string, binary->pch_file);
+        S_chaz_MakeRule_write(rule, out);
+        S_chaz_MakeRule_destroy(rule);
+    }
+
+    free(obj_string);
+    free(cflags);
+}
+
+static void
+S_chaz_MakeFile_finalize_loading_groups(chaz_MakeFile *self) {
+    size_t i, j;
+
+    for (i = 0; self->binaries[i]; i++) {
+        chaz_MakeBinary *binary = self->binaries[i];
+
+        if (binary->type != CHAZ_MAKEBINARY_SHARED_LIB
+            || !binary->optimize_loading
+           ) {
+            continue;
+        }
+        for (j = 0; j < binary->num_groups; j++) {
+            chaz_CFlags *flags  = binary->groups[j]->cflags;
+            const char  *string = chaz_CFlags_get_string(flags);
+
+            /* Groups can be linked into several shared libraries. */
+            if (strstr(string, "-fno-semantic-interposition") == NULL) {
+                chaz_CFlags_disable_semantic_interposition(flags);
+            }
+        }
+    }
+}
+
+static int
+S_chaz_MakeBinary_symbols_hidden(chaz_MakeBinary *binary) {
+    size_t i;
+
+    if (!chaz_CFlags_symbols_hidden(binary->cflags)) { return 0; }
+    for (i = 0; i < binary->num_groups; i++) {
+        if (!chaz_CFlags_symbols_hidden(binary->groups[i]->cflags)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static void
+S_chaz_MakeFile_finalize(chaz_MakeFile *self) {
+    size_t i;
+
+    if (self->finalized) { return; }
+    self->finalized = 1;
+
+    S_chaz_MakeFile_finalize_loading_groups(self);
+
+    /* Finalize binary vars. */
+    for (i = 0; self->binaries[i]; i++) {
+        chaz_MakeBinary *binary = self->binaries[i];
+        const char *flags;
+
+        flags = chaz_CFlags_get_string(binary->cflags);
+        chaz_MakeVar_append(binary->cflags_var, flags);
+        if (binary->optimize_loading) {
+            chaz_CFlags *loading_flags = chaz_CC_new_cflags();
+            chaz_CFlags_optimize_dynamic_loading(loading_flags);
+            if (binary->type == CHAZ_MAKEBINARY_SHARED_LIB
+                && S_chaz_MakeBinary_symbols_hidden(binary)
+               ) {
+                chaz_CFlags_link_symbolic_functions(loading_flags);
+            }
+            chaz_MakeVar_append(binary->ldflags_var,
+                                chaz_CFlags_get_string(loading_flags));
+            chaz_CFlags_destroy(loading_flags);
+        }
+        flags = chaz_CFlags_get_string(binary->ldflags);
+        chaz_MakeVar_append(binary->ldflags_var, flags);
+
+        if (binary->num_unity_batches > 0) {
+            S_chaz_MakeFile_prepare_unity_batches(self, binary);
+        }
+
+        if (binary->split_dwarf) {
+            char *dwo_files = chaz_Util_join("", "$(", binary->obj_var->name,
+                                             ":", chaz_CC_obj_ext(),
+                                             "=.dwo)", NULL);
+            chaz_MakeRule_add_rm_command(self->clean, dwo_files);
+            free(dwo_files);
+        }
+
+        if (binary->pch_file) {
+            chaz_MakeRule_add_rm_command(self->clean, binary->pch_file);
+            if (chaz_CC_is_msvc()) {
+                /* MSVC needs a source file to create the PCH. */
+                char *stub    = S_chaz_MakeBinary_generated_path(binary,
+                                                                 "_pch.c");
+                char *content = chaz_Util_join("", "#include \"",
+                                               binary->pch_header, "\"\n",
+                                               NULL);
+                char *pch     = S_chaz_MakeBinary_msvc_pch_path(binary);
+                chaz_Util_update_file(stub, content);
+                chaz_MakeRule_add_rm_command(self->clean, pch);
+                chaz_MakeRule_add_rm_command(self->distclean, stub);
+                chaz_MakeVar_append(binary->obj_var, binary->pch_file);
+                free(pch);
+                free(content);
+                free(stub);
+            }
+        }
+    }
+
+    /* Add the objects of groups after the unity batches replaced the
+     * objects of the sources. */
+    for (i = 0; self->binaries[i]; i++) {
+        chaz_MakeBinary *binary = self->binaries[i];
+        size_t j;
+
+        for (j = 0; j < binary->num_groups; j++) {
+            chaz_MakeVar_append(binary->obj_var,
+                                binary->groups[j]->obj_dollar_var);
+        }
+    }
+
+    for (i = 0; self->binaries[i]; i++) {
+        S_chaz_MakeFile_prepare_response_file(self, self->binaries[i]);
+    }
+
+    if (S_chaz_Make_build_timing()) {
+        char *exe = chaz_Util_join("", "build-timer", chaz_CC_exe_ext(),
+                                   NULL);
+        chaz_MakeRule_add_rm_command(self->distclean, exe);
+        chaz_MakeRule_add_rm_command(self->distclean, "build-timing.log");
+        free(exe);
+    }
+
+    if (self->num_install_dirs) {
+        /* Prepend mkdir commands. */
+        chaz_MakeRule *dummy = S_chaz_MakeRule_new(NULL, NULL);
+
+        for (i = 0; self->install_dirs[i]; i++) {
+            chaz_MakeRule_add_mkdir_command(dummy, self->install_dirs[i]);
+        }
+        if (self->install->commands.ptr) {
+            chaz_Buf_append(&dummy->commands, self->install->commands.ptr);
+        }
+
+        chaz_Buf_clear(&self->install->commands);
+        self->install->commands = dummy->commands;
+        chaz_Buf_init(&dummy->commands);
+
+        S_chaz_MakeRule_destroy(dummy);
+    }
+}
+
+static void
+S_chaz_MakeFile_prepare_response_file(chaz_MakeFile *self,
+                                      chaz_MakeBinary *binary) {
+    const char *builddir = S_chaz_Make_builddir();
+    char       *obj_string;
+    char       *obj;
+    char       *path;
+    char       *arg;
+    chaz_Buf    content;
+
+    if (!binary->response_file) { return; }
+
+    /* The response file lists the objects of a single build directory. */
+    if (chaz_Make.variants) {
+        chaz_Util_warn("Response files aren't supported with build"
+                       " variants");
+        return;
+    }
+
+    obj_string = chaz_MakeBinary_obj_string(binary);
+
+    /* The response file is written now, like unity batches, so the build
+     * directory must be expanded. The objects stay prerequisites of the
+     * binary. */
+    chaz_Buf_init(&content);
+    for (obj = strtok(obj_string, " "); obj; obj = strtok(NULL, " ")) {
+        if (builddir && strncmp(obj, "$(BUILDDIR)", 11) == 0) {
+            chaz_Buf_append(&content, builddir);
+            obj += 11;
+        }
+        chaz_Buf_append(&content, obj);
+        chaz_Buf_append(&content, "\n");
+    }
+
+    path = S_chaz_MakeBinary_generated_path(binary, ".rsp");
+    chaz_Util_update_file(path, content.ptr ? content.ptr : "");
+    chaz_MakeRule_add_rm_command(self->distclean, path);
+
+    arg = chaz_Util_join("", "@", path, NULL);
+    S_chaz_MakeRule_replace_in_commands(binary->rule, binary->obj_dollar_var,
+                                        arg);
+
+    free(arg);
+    free(path);
+    chaz_Buf_clear(&content);
+    free(obj_string);
+}
+
+void
+chaz_MakeFile_add_pgo_training(chaz_MakeFile *self, const char *command) {
+    if (self->pgo_train == NULL) {
+        self->pgo_train = S_chaz_MakeRule_new("pgo-train", "pgo-generate");
+    }
+    chaz_MakeRule_add_command(self->pgo_train, command);
+}
+
+chaz_CFlags*
+chaz_MakeFile_add_variant(chaz_MakeFile *self, const char *name) {
+    chaz_CFlags *cflags;
+    size_t       alloc_size;
+
+    /* Object paths are computed when sources are added, so they must
+     * already refer to the build directory. */
+    if (self->binaries[0] != NULL) {
+        chaz_Util_die("Variant '%s' must be added before binaries", name);
+    }
+    chaz_Make.variants = 1;
+
+    cflags = chaz_CC_new_cflags();
+    alloc_size = (self->num_variants + 1) * sizeof(char*);
+    self->variant_names = (char**)realloc(self->variant_names, alloc_size);
+    alloc_size = (self->num_variants + 1) * sizeof(chaz_CFlags*);
+    self->variant_cflags
+        = (chaz_CFlags**)realloc(self->variant_cflags, alloc_size);
+    self->variant_names[self->num_variants]  = chaz_Util_strdup(name);
+    self->variant_cflags[self->num_variants] = cflags;
+    self->num_variants++;
+
+    return cflags;
+}
+
+void
+chaz_MakeFile_add_default_variants(chaz_MakeFile *self) {
+    chaz_CFlags *cflags;
+
+    /* Variant flags follow the base flags, so this overrides an
+     * optimization level from --cflags. */
+    cflags = chaz_MakeFile_add_variant(self, "debug");
+    chaz_CFlags_disable_optimization(cflags);
+    chaz_CFlags_enable_debugging(cflags);
+
+    cflags = chaz_MakeFile_add_variant(self, "release");
+    chaz_CFlags_enable_optimization(cflags);
+    chaz_CFlags_add_define(cflags, "NDEBUG", NULL);
+
+    /* Optimized code with symbols and frame pointers for sampling
+     * profilers like perf. */
+    cflags = chaz_MakeFile_add_variant(self, "profile");
+    chaz_CFlags_enable_optimization(cflags);
+    chaz_CFlags_enable_debugging(cflags);
+    chaz_CFlags_keep_frame_pointers(cflags);
+
+    if (chaz_CC_is_gcc()) {
+        cflags = chaz_MakeFile_add_variant(self, "coverage");
+        chaz_CFlags_enable_debugging(cflags);
+        chaz_CFlags_enable_code_coverage(cflags);
+    }
+}
+
+static void
+S_chaz_MakeFile_write_variant_rules(chaz_MakeFile *self, FILE *out) {
+    const char *dir_sep  = chaz_OS_dir_sep();
+    const char *builddir = S_chaz_Make_builddir();
+    char       *root;
+    size_t      i;
+
+    if (strcmp(builddir, ".") == 0) {
+        root = chaz_Util_strdup("variants");
+    }
+    else {
+        root = chaz_Util_join(dir_sep, builddir, "variants", NULL);
+    }
+
+    for (i = 0; i < self->num_variants; i++) {
+        const char    *name  = self->variant_names[i];
+        const char    *flags = chaz_CFlags_get_string(self->variant_cflags[i]);
+        char          *dir   = chaz_Util_join(dir_sep, root, name, NULL);
+        chaz_MakeRule *rule  = S_chaz_MakeRule_new(name, NULL);
+        chaz_Buf       command;
+        size_t         j;
+
+        /* The targets of the variant must be passed with the build
+         * directory expanded. */
+        chaz_Buf_init(&command);
+        chaz_Buf_append(&command, "$(MAKE) BUILDDIR=");
+        chaz_Buf_append(&command, dir);
+        chaz_Buf_append(&command, " VARIANT_CFLAGS=\"");
+        chaz_Buf_append(&command, flags);
+        chaz_Buf_append(&command, "\"");
+        for (j = 0; self->binaries[j]; j++) {
+            chaz_MakeBinary *binary = self->binaries[j];
+            const char *target = binary->rule->targets.ptr;
+
+            if (binary->type == CHAZ_MAKEBINARY_OBJECT_GROUP) { continue; }
+            chaz_Buf_append(&command, " ");
+            if (strncmp(target, "$(BUILDDIR)", 11) == 0) {
+                chaz_Buf_append(&command, dir);
+                target += 11;
+            }
+            chaz_Buf_append(&command, target);
+        }
+        chaz_MakeRule_add_command(rule, command.ptr);
+        S_chaz_MakeRule_write(rule, out);
+
+        chaz_Buf_clear(&command);
+        S_chaz_MakeRule_destroy(rule);
+        free(dir);
+    }
+
+    chaz_MakeRule_add_recursive_rm_command(self->clean, root);
+    free(root);
+}
+
+static void
+S_chaz_MakeFile_write_pgo_rules(chaz_MakeFile *self, FILE *out) {
+    chaz_MakeRule *generate = S_chaz_MakeRule_new("pgo-generate", NULL);
+    chaz_MakeRule *use      = S_chaz_MakeRule_new("pgo-use", NULL);
+    chaz_MakeRule *train;
+    const char    *generate_flags;
+    const char    *use_flags;
+    char          *targets = chaz_Util_strdup("");
+    char          *command;
+    size_t         i;
+
+    if (chaz_CC_is_clang()) {
+        generate_flags
+            = "-fprofile-instr-generate=$(PGO_DIR)/%p.profraw";
+        use_flags
+            = "-fprofile-instr-use=$(PGO_DIR)/default.profdata";
+    }
+    else {
+        generate_flags = "-fprofile-generate=$(PGO_DIR)";
+        use_flags      = "-fprofile-use=$(PGO_DIR) -fprofile-correction";
+    }
+
+    /* Rebuild all binaries in both stages. */
+    for (i = 0; self->binaries[i]; i++) {
+        chaz_MakeBinary *binary = self->binaries[i];
+        const char *target = binary->rule->targets.ptr;
+        char *tmp;
+
+        chaz_MakeRule_add_rm_command(generate, binary->obj_dollar_var);
+        chaz_MakeRule_add_rm_command(generate, target);
+        chaz_MakeRule_add_rm_command(use, binary->obj_dollar_var);
+        chaz_MakeRule_add_rm_command(use, target);
+
+        tmp = chaz_Util_join(" ", targets, target, NULL);
+        free(targets);
+        targets = tmp;
+    }
+
+    chaz_MakeRule_add_recursive_rm_command(generate, "$(PGO_DIR)");
+    command = chaz_Util_join("", "$(MAKE) PGO_CFLAGS=\"", generate_flags,
+                             "\"", targets, NULL);
+    chaz_MakeRule_add_command(generate, command);
+    free(command);
+
+    command = chaz_Util_join("", "$(MAKE) PGO_CFLAGS=\"", use_flags, "\"",
+                             targets, NULL);
+    chaz_MakeRule_add_command(use, command);
+    free(command);
+
+    /* Clang writes raw profiles which must be merged. */
+    train = S_chaz_MakeRule_new("pgo-train", "pgo-generate");
+    chaz_Buf_append(&train->commands, self->pgo_train->commands.ptr);
+    if (chaz_CC_is_clang()) {
+        chaz_MakeRule_add_command(train,
+            "llvm-profdata merge -output=$(PGO_DIR)/default.profdata"
+            " $(PGO_DIR)/*.profraw");
+    }
+
+    S_chaz_MakeRule_write(generate, out);
+    S_chaz_MakeRule_write(train, out);
+    S_chaz_MakeRule_write(use, out);
+
+    chaz_MakeRule_add_recursive_rm_command(self->clean, "$(PGO_DIR)");
+
+    S_chaz_MakeRule_destroy(use);
+    S_chaz_MakeRule_destroy(train);
+    S_chaz_MakeRule_destroy(generate);
+    free(targets);
+}
+
+void
+chaz_MakeFile_write_ninja(chaz_MakeFile *self) {
+    chaz_MakeRule_add_rm_command(self->distclean,
+                                 "build.ninja .ninja_deps .ninja_log");
+    S_chaz_MakeFile_do_write_ninja(self);
+}
+
+static void
+S_chaz_MakeFile_do_write_ninja(chaz_MakeFile *self) {
+    FILE          *out;
+    chaz_MakeRule *report;
+    char          *launcher;
+    chaz_Buf       defaults;
+    int            saved_pgo       = chaz_Make.pgo;
+    int            saved_dep_files = chaz_Make.dep_files;
+    int            saved_launcher  = chaz_Make.launcher;
+    int            need_link_pool  = 0;
+    size_t         i;
+
+    S_chaz_MakeFile_finalize(self);
+
+    if (self->pgo_train) {
+        chaz_Util_warn("Profile-guided optimization targets are only"
+                       " written to the Makefile");
+    }
+    if (self->num_variants > 0) {
+        chaz_Util_warn("Build variant targets are only written to the"
+                       " Makefile");
+    }
+
+    out = chaz_Util_open_updated_file("build.ninja");
+
+    /* Variables are expanded when build.ninja is written, so the compile
+     * command must not reference PGO_CFLAGS or DEPFLAGS. */
+    launcher = S_chaz_Make_compiler_launcher();
+    chaz_Make.pgo       = 0;
+    chaz_Make.dep_files = 0;
+    chaz_Make.launcher  = launcher != NULL;
+    free(launcher);
+
+    fprintf(out, "# Generated by Charmonizer. Do not edit.\n\n");
+    /* Version 1.3 is needed for 'deps'. */
+    fprintf(out, "ninja_required_version = 1.3\n\n");
+
+    for (i = 0; self->binaries[i]; i++) {
+        if (self->binaries[i]->lto) { need_link_pool = 1; }
+    }
+    if (need_link_pool) {
+        /* LTO links use all cores on their own, so run only one at a
+         * time. */
+        fprintf(out, "pool link_pool\n  depth = 1\n\n");
+    }
+
+    for (i = 0; self->rules[i]; i++) {
+        char name[30];
+        sprintf(name, "rule%u", (unsigned)i);
+        /* Custom commands like code generators may leave their outputs
+         * untouched. Don't rebuild dependents in this case. */
+        S_chaz_MakeFile_write_ninja_rule(self, self->rules[i], name,
+                                         "  restat = 1\n", out);
+    }
+
+    for (i = 0; self->binaries[i]; i++) {
+        S_chaz_MakeFile_write_ninja_binary(self, self->binaries[i], out);
+    }
+
+    report = S_chaz_Make_build_report_rule();
+    if (report) {
+        S_chaz_MakeFile_write_ninja_rule(self, report, "build_report", "",
+                                         out);
+        S_chaz_MakeRule_destroy(report);
+    }
+
+    S_chaz_MakeFile_write_ninja_rule(self, self->install, "install", "",
+                                     out);
+    S_chaz_MakeFile_write_ninja_rule(self, self->clean, "clean", "", out);
+    S_chaz_MakeFile_write_ninja_rule(self, self->distclean, "distclean", "",
+                                     out);
+
+    /* Without a default statement, ninja would also run targets like
+     * 'clean'. Use the 'all' target if there is one. */
+    chaz_Buf_init(&defaults);
+    for (i = 0; self->rules[i]; i++) {
+        if (strcmp(self->rules[i]->targets.ptr, "all") == 0) {
+            chaz_Buf_append(&defaults, "all");
+            break;
+        }
+    }
+    if (defaults.len == 0) {
+        for (i = 0; self->binaries[i]; i++) {
+            chaz_MakeRule *rule  = self->binaries[i]->rule;
+            char          *paths = S_chaz_MakeFile_ninja_paths(
+                                       self, rule->targets.ptr);
+            if (defaults.len != 0) { chaz_Buf_append(&defaults, " "); }
+            chaz_Buf_append(&defaults, paths);
+            free(paths);
+        }
+    }
+    if (defaults.len != 0) {
+        fprintf(out, "default %s\n", defaults.ptr);
+    }
+    chaz_Buf_clear(&defaults);
+
+    chaz_Util_close_updated_file(out, "build.ninja");
+
+    chaz_Make.pgo       = saved_pgo;
+    chaz_Make.dep_files = saved_dep_files;
+    chaz_Make.launcher  = saved_launcher;
+}
+
+static void
+S_chaz_MakeFile_write_ninja_binary(chaz_MakeFile *self,
+                                   chaz_MakeBinary *binary, FILE *out) {
+    char   *name       = S_chaz_MakeBinary_generated_path(binary, "");
+    char   *cc_rule    = chaz_Util_join("_", "cc", name, NULL);
+    char   *link_rule  = chaz_Util_join("_", "link", name, NULL);
+    char   *obj_cflags = S_chaz_MakeBinary_obj_cflags(binary);
+    char   *implicit   = NULL;
+    int    *batches;
+    int     num_batches;
+    int     i;
+    size_t  j;
+
+    if (binary->pch_file) {
+        char *cflags = chaz_Util_join("", "$(", binary->cflags_var->name,
+                                      ")", NULL);
+        char *pch_cflags;
+        char *pch_rule = chaz_Util_join("_", "pch", name, NULL);
+        char *source;
+
+        if (chaz_CC_is_msvc()) {
+            /* The PCH is created as a side effect of compiling the stub. */
+            char *pch = S_chaz_MakeBinary_msvc_pch_path(binary);
+            source = S_chaz_MakeBinary_generated_path(binary, "_pch.c");
+            pch_cflags = chaz_Util_join("", cflags, " /Yc\"",
+                                        binary->pch_header, "\" /Fp", pch,
+                                        NULL);
+            free(pch);
+        }
+        else {
+            source = chaz_Util_strdup(binary->pch_header);
+            pch_cflags = chaz_Util_join(" ", cflags, "-x c-header", NULL);
+        }
+
+        S_chaz_MakeFile_write_ninja_cc_rule(self, pch_rule, pch_cflags, out);
+        S_chaz_MakeFile_write_ninja_build(self, binary->pch_file, pch_rule,
+                                          source, NULL, out);
+        implicit = binary->pch_file;
+
+        free(source);
+        free(pch_rule);
+        free(pch_cflags);
+        free(cflags);
+    }
+
+    if (binary->num_sources > 0) {
+        S_chaz_MakeFile_write_ninja_cc_rule(self, cc_rule, obj_cflags, out);
+    }
+
+    batches = S_chaz_MakeBinary_unity_batches(binary, &num_batches);
+    for (i = 0; i < num_batches; i++) {
+        char     *path     = S_chaz_MakeBinary_unity_path(binary, i);
+        char     *obj_path = S_chaz_MakeBinary_obj_path(path);
+        chaz_Buf  deps;
+
+        /* Rebuild the batch if any of the included sources changes. */
+        chaz_Buf_init(&deps);
+        chaz_Buf_append(&deps, implicit ? implicit : "");
+        for (j = 0; j < binary->num_sources; j++) {
+            if (batches[j] == i) {
+                chaz_Buf_append(&deps, " ");
+                chaz_Buf_append(&deps, binary->sources[j]);
+            }
+        }
+
+        S_chaz_MakeFile_write_ninja_build(self, obj_path, cc_rule, path,
+                                          deps.ptr, out);
+
+        chaz_Buf_clear(&deps);
+        free(obj_path);
+        free(path);
+    }
+
+    for (j = 0; j < binary->num_sources; j++) {
+        const char *source = binary->sources[j];
+        char *obj_path;
+
+        if (batches && batches[j] >= 0) { continue; }
+
+        obj_path = S_chaz_MakeBinary_obj_path(source);
+        if (obj_path == NULL) { continue; }
+        if (S_chaz_MakeBinary_flagged_index(binary, source) < 0) {
+            S_chaz_MakeFile_write_ninja_build(self, obj_path, cc_rule,
+                                              source, implicit, out);
+        }
+        free(obj_path);
+    }
+    free(batches);
+
+    /* Every source with its own flags gets its own rule. */
+    for (j = 0; j < binary->num_flagged_sources; j++) {
+        const char *source = binary->flagged_sources[j];
+        char  *obj_path = S_chaz_MakeBinary_obj_path(source);
+        char  *cflags;
+        char   rule_name[30];
+        char  *flagged_rule;
+
+        if (obj_path == NULL) { continue; }
+        sprintf(rule_name, "src%u", (unsigned)j);
+        flagged_rule = chaz_Util_join("_", cc_rule, rule_name, NULL);
+        cflags = S_chaz_MakeBinary_flagged_cflags(binary, (int)j);
+        S_chaz_MakeFile_write_ninja_cc_rule(self, flagged_rule, cflags, out);
+        S_chaz_MakeFile_write_ninja_build(self, obj_path, flagged_rule,
+                                          source, NULL, out);
+        free(cflags);
+        free(flagged_rule);
+        free(obj_path);
+    }
+
+    S_chaz_MakeFile_write_ninja_rule(self, binary->rule, link_rule,
+                                     binary->lto
+                                     ? "  description = LINK $out\n"
+                                       "  pool = link_pool\n"
+                                     : "  description = LINK $out\n",
+                                     out);
+
+    free(obj_cflags);
+    free(link_rule);
+    free(cc_rule);
+    free(name);
+}
+
+static void
+S_chaz_MakeFile_write_ninja_cc_rule(chaz_MakeFile *self, const char *name,
+                                    const char *cflags, FILE *out) {
+    chaz_CFlags *dep_flags = chaz_CC_new_cflags();
+    const char  *deps      = NULL;
+    char        *all_cflags;
+    char        *command;
+    char        *expanded;
+
+    /* Let ninja track header dependencies. */
+    if (chaz_CFlags_generate_dep_files(dep_flags)) {
+        all_cflags = chaz_Util_join(" ", cflags, "-MMD -MF $@.d", NULL);
+        deps = "gcc";
+    }
+    else if (chaz_CC_is_msvc()) {
+        all_cflags = chaz_Util_join(" ", cflags, "/showIncludes", NULL);
+        deps = "msvc";
+    }
+    else {
+        all_cflags = chaz_Util_strdup(cflags);
+    }
+
+    command  = S_chaz_MakeFile_compile_command(all_cflags, "$<");
+    expanded = S_chaz_MakeFile_ninja_expand(self, command, 0);
+    fprintf(out, "rule %s\n  command = %s\n", name, expanded);
+    if (deps) {
+        if (strcmp(deps, "gcc") == 0) {
+            fprintf(out, "  depfile = $out.d\n");
+        }
+        fprintf(out, "  deps = %s\n", deps);
+    }
+    fprintf(out, "  description = CC $out\n\n");
+
+    free(expanded);
+    free(command);
+    free(all_cflags);
+    chaz_CFlags_destroy(dep_flags);
+}
+
+static void
+S_chaz_MakeFile_write_ninja_rule(chaz_MakeFile *self, chaz_MakeRule *rule,
+                                 const char *name, const char *bindings,
+                                 FILE *out) {
+    const char *prereqs = rule->prereqs.ptr ? rule->prereqs.ptr : "";
+    char *command;
+
+    if (rule->commands.ptr == NULL) {
+        S_chaz_MakeFile_write_ninja_build(self, rule->targets.ptr, "phony",
+                                          prereqs, NULL, out);
+        return;
+    }
+
+    command = S_chaz_MakeFile_ninja_command(self, rule->commands.ptr);
+    fprintf(out, "rule %s\n  command = %s\n%s\n", name, command, bindings);
+    S_chaz_MakeFile_write_ninja_build(self, rule->targets.ptr, name, prereqs,
+                                      NULL, out);
+    free(command);
+}
+
+static void
+S_chaz_MakeFile_write_ninja_build(chaz_MakeFile *self, const char *targets,
+                                  const char *rule, const char *inputs,
+                                  const char *implicit, FILE *out) {
+    char *outputs  = S_chaz_MakeFile_ninja_paths(self, targets);
+    char *explicit = S_chaz_MakeFile_ninja_paths(self, inputs ? inputs : "");
+    char *rest     = NULL;
+
+    /* Only the first input is explicit, so that it can be referenced as
+     * '$<' in make commands and '$in' in ninja. */
+    if (inputs && strcmp(rule, "phony") != 0) {
+        char *space = strchr(explicit, ' ');
+        if (space) {
+            *space = '\0';
+            rest = chaz_Util_strdup(space + 1);
+        }
+    }
+    if (implicit) {
+        char *paths = S_chaz_MakeFile_ninja_paths(self, implicit);
+        if (rest) {
+            char *tmp = chaz_Util_join(" ", rest, paths, NULL);
+            free(rest);
+            free(paths);
+            rest = tmp;
+        }
+        else {
+            rest = paths;
+        }
+    }
+
+    fprintf(out, "build %s: %s", outputs, rule);
+    if (explicit[0] != '\0') {
+        fprintf(out, " %s", explicit);
+    }
+    if (rest && rest[0] != '\0') {
+        fprintf(out, " | %s", rest);
+    }
+    fprintf(out, "\n\n");
+
+    free(rest);
+    free(explicit);
+    free(outputs);
+}
+
+static char*
+S_chaz_MakeFile_ninja_command(chaz_MakeFile *self, const char *commands) {
+    const char *line  = commands;
+    int         first = 1;
+    chaz_Buf    result;
+
+    /* Ninja runs commands directly on Windows. */
+    chaz_Buf_init(&result);
+    if (chaz_Make.shell_type == CHAZ_OS_CMD_EXE) {
+        chaz_Buf_append(&result, "cmd /c ");
+    }
+
+    while (*line) {
+        const char *end = strchr(line, '\n');
+        size_t      len = end ? (size_t)(end - line) : strlen(line);
+        char       *command;
+        size_t      skip = 0;
+
+        /* Strip the tab and make's command prefixes. */
+        while (skip < len && strchr("\t@-+", line[skip])) { skip++; }
+        command = (char*)malloc(len - skip + 1);
+        memcpy(command, line + skip, len - skip);
+        command[len-skip] = '\0';
+
+        if (command[0] != '\0') {
+            char *expanded = S_chaz_MakeFile_ninja_expand(self, command, 0);
+            if (!first) { chaz_Buf_append(&result, " && "); }
+            chaz_Buf_append(&result, expanded);
+            free(expanded);
+            first = 0;
+        }
+
+        free(command);
+        line += end ? len + 1 : len;
+    }
+
+    return chaz_Buf_yield(&result);
+}
+
+static char*
+S_chaz_MakeFile_ninja_paths(chaz_MakeFile *self, const char *string) {
+    char       *expanded = S_chaz_MakeFile_ninja_expand(self, string, 0);
+    char       *result   = (char*)malloc(2 * strlen(expanded) + 1);
+    const char *p        = expanded;
+    size_t      len      = 0;
+
+    while (*p) {
+        /* Collapse whitespace and escape colons. */
+        if (isspace((unsigned char)*p)) {
+            while (isspace((unsigned char)*p)) { p++; }
+            if (len > 0 && *p) { result[len++] = ' '; }
+            continue;
+        }
+        if (*p == ':') { result[len++] = '$'; }
+        result[len++] = *p++;
+    }
+    result[len] = '\0';
+
+    free(expanded);
+    return result;
+}
+
+static char*
+S_chaz_MakeFile_ninja_expand(chaz_MakeFile *self, const char *string,
+                             int depth) {
+    chaz_Buf    result;
+    const char *p = string;
+
+    if (depth > 20) {
+        chaz_Util_die("Recursive make variable in '%s'", string);
+    }
+
+    chaz_Buf_init(&result);
+
+    while (*p) {
+        const char *text;
+        size_t      text_len;
+        char       *value = NULL;
+
+        if (p[0] == '\\' && p[1] == '\n') {
+            /* Line continuation including indentation. */
+            text = " ";
+            text_len = 1;
+            p += 2;
+            while (*p == ' ' || *p == '\t') { p++; }
+        }
+        else if (p[0] != '$') {
+            text = p;
+            text_len = 1;
+            p += 1;
+        }
+        else if (p[1] == '$') {
+            text = "$$";
+            text_len = 2;
+            p += 2;
+        }
+        else if (p[1] == '@') {
+            text = "$out";
+            text_len = 4;
+            p += 2;
+        }
+        else if (p[1] == '<') {
+            text = "$in";
+            text_len = 3;
+            p += 2;
+        }
+        else if (p[1] == '(' || p[1] == '{') {
+            const char *end = strchr(p + 2, p[1] == '(' ? ')' : '}');
+            char       *name;
+            char       *from = NULL;
+            char       *to   = NULL;
+            char       *raw;
+
+            if (end == NULL) {
+                chaz_Util_die("Unterminated variable reference in '%s'",
+                              string);
+            }
+            name = (char*)malloc((size_t)(end - p) - 1);
+            memcpy(name, p + 2, (size_t)(end - p) - 2);
+            name[end-p-2] = '\0';
+
+            /* Substitution reference like $(OBJS:.o=.d). */
+            from = strchr(name, ':');
+            if (from) {
+                *from++ = '\0';
+                to = strchr(from, '=');
+                if (to) { *to++ = '\0'; }
+            }
+
+            raw = S_chaz_MakeFile_var_value(self, name);
+            if (raw) {
+                value = S_chaz_MakeFile_ninja_expand(self, raw, depth + 1);
+                if (from && to) {
+                    char *tmp = S_chaz_Make_subst_suffix(value, from, to);
+                    free(value);
+                    value = tmp;
+                }
+                free(raw);
+            }
+            else {
+                /* Make falls back to the environment, e.g. for CFLAGS.
+                 * Refer to a ninja variable instead, so that build.ninja
+                 * doesn't depend on the environment at configure time. */
+                value = S_chaz_MakeFile_ninja_var_ref(name);
+            }
+
+            free(name);
+            text = value ? value : "";
+            text_len = strlen(text);
+            p = end + 1;
+        }
+        else {
+            /* Unsupported automatic variable. */
+            text = "";
+            text_len = 0;
+            p += p[1] ? 2 : 1;
+        }
+
+        chaz_Buf_append_len(&result, text, text_len);
+        free(value);
+    }
+
+    return chaz_Buf_yield(&result);
+}
+
+static char*
+S_chaz_MakeFile_ninja_var_ref(const char *name) {
+    size_t i;
+
+    if (name[0] == '\0') {
+        chaz_Util_die("Empty make variable reference");
+    }
+    for (i = 0; name[i]; i++) {
+        if (!isalnum((unsigned char)name[i]) && name[i] != '_') {
+            chaz_Util_die("Make variable '%s' isn't defined and can't be"
+                          " written to build.ninja", name);
+        }
+    }
+
+    return chaz_Util_join("", "${", name, "}", NULL);
+}
+
+static char*
+S_chaz_MakeFile_var_value(chaz_MakeFile *self, const char *name) {
+    const char *value = NULL;
+    char       *install_var;
+    size_t      i;
+
+    for (i = 0; self->vars[i]; i++) {
+        if (strcmp(self->vars[i]->name, name) == 0) {
+            return chaz_Util_strdup(self->vars[i]->value.ptr);
+        }
+    }
+
+    install_var = S_chaz_Make_install_var(name);
+    if (install_var) { return install_var; }
+
+    if (strcmp(name, "BUILDDIR") == 0) {
+        value = S_chaz_Make_builddir();
+    }
+    else if (strcmp(name, "CC") == 0) {
+        value = chaz_CC_get_cc();
+    }
+    else if (strcmp(name, "LINK") == 0) {
+        if (S_chaz_Make_build_timing()) {
+            return chaz_Util_join(" ", "$(BUILD_TIMER) $@",
+                                  chaz_CC_link_command(), NULL);
+        }
+        value = chaz_CC_link_command();
+    }
+    else if (strcmp(name, "BUILD_TIMER") == 0) {
+        return S_chaz_Make_build_timer_var();
+    }
+    else if (strcmp(name, "VARIANT_CFLAGS") == 0) {
+        /* Only set by recursive make invocations. */
+        value = "";
+    }
+    else if (strcmp(name, "CC_LAUNCHER") == 0) {
+        return S_chaz_Make_compiler_launcher();
+    }
+    else if (strcmp(name, "MAKE") == 0) {
+        value = chaz_Make_get_make();
+    }
+    else if (strcmp(name, "CURDIR") == 0) {
+        /* Resolved by the shell when the command runs, so build.ninja
+         * doesn't contain the directory it was generated in. */
+        value = "$$PWD";
+    }
+    else {
+        return NULL;
+    }
+
+    return chaz_Util_strdup(value ? value : "");
+}
+
+static char*
+S_chaz_Make_subst_suffix(const char *words, const char *from,
+                         const char *to) {
+    size_t      from_len = strlen(from);
+    chaz_Buf    result;
+    const char *p        = words;
+
+    chaz_Buf_init(&result);
+    while (*p) {
+        const char *end;
+        size_t      word_len;
+        size_t      keep;
+        const char *suffix = "";
+
+        while (isspace((unsigned char)*p)) { p++; }
+        if (*p == '\0') { break; }
+        end = p;
+        while (*end && !isspace((unsigned char)*end)) { end++; }
+        word_len = (size_t)(end - p);
+
+        keep = word_len;
+        if (word_len >= from_len
+            && memcmp(end - from_len, from, from_len) == 0
+           ) {
+            keep   = word_len - from_len;
+            suffix = to;
+        }
+
+        if (result.len != 0) { chaz_Buf_append(&result, " "); }
+        chaz_Buf_append_len(&result, p, keep);
+        chaz_Buf_append(&result, suffix);
+
+        p = end;
+    }
+
+    return chaz_Buf_yield(&result);
+}
+
+char*
+chaz_Make_build_dir(const char *dir) {
+    if (S_chaz_Make_builddir() == NULL) {
+        return chaz_Util_strdup(dir ? dir : ".");
+    }
+    return S_chaz_Make_builddir_path(dir ? dir : ".");
+}
+
+static char*
+S_chaz_Make_builddir_path(const char *path) {
+    const char *dir_sep = chaz_OS_dir_sep();
+    const char *p       = path;
+    chaz_Buf    result;
+
+    chaz_Buf_init(&result);
+    chaz_Buf_append(&result, "$(BUILDDIR)");
+    if (p[0] == '/' || p[0] == '\\') {
+        chaz_Buf_append(&result, dir_sep);
+        chaz_Buf_append(&result, "_root");
+    }
+
+    while (*p) {
+        size_t len;
+
+        while (*p == '/' || *p == '\\') { p++; }
+        for (len = 0; p[len] && p[len] != '/' && p[len] != '\\'; len++) {}
+        if (len == 0) { break; }
+
+        if (len == 2 && p[0] == '.' && p[1] == '.') {
+            chaz_Buf_append(&result, dir_sep);
+            chaz_Buf_append(&result, "__");
+        }
+        else if (len == 2 && p[1] == ':') {
+            /* Drive letter. */
+            chaz_Buf_append(&result, dir_sep);
+            chaz_Buf_append_len(&result, p, 1);
+            chaz_Buf_append(&result, "_");
+        }
+        else if (len != 1 || p[0] != '.') {
+            chaz_Buf_append(&result, dir_sep);
+            chaz_Buf_append_len(&result, p, len);
+        }
+
+        p += len;
+    }
+
+    return chaz_Buf_yield(&result);
+}
+
+static const char*
+S_chaz_Make_builddir(void) {
+    const char *builddir;
+
+    builddir = chaz_Make.cli ? chaz_CLI_strval(chaz_Make.cli, "builddir")
+                             : NULL;
+    if (builddir == NULL || builddir[0] == '\0') {
+        /* Build variants need object paths below $(BUILDDIR). */
+        return chaz_Make.variants ? "." : NULL;
+    }
+
+    return builddir;
+}
+
+static char*
+S_chaz_Make_compiler_launcher(void) {
+    const char *option = chaz_CLI_strval(chaz_Make.cli, "compiler-launcher");
+    char       *launcher;
+    const char *base;
+
+    if (option == NULL || option[0] == '\0') { return NULL; }
+
+    if (strcmp(option, "auto") == 0) {
+        launcher = chaz_OS_find_executable("ccache");
+        if (launcher == NULL) {
+            launcher = chaz_OS_find_executable("sccache");
+        }
+        if (launcher == NULL) {
+            if (chaz_Util_verbosity) {
+                printf("No compiler launcher found\n");
+            }
+            return NULL;
+        }
+        if (chaz_Util_verbosity) {
+            printf("Detected compiler launcher '%s'\n", launcher);
+        }
+    }
+    else {
+        launcher = chaz_Util_strdup(option);
+    }
+
+    /* Let ccache rewrite absolute paths below the build directory to
+     * relative paths, so that the cache can be shared between checkouts
+     * in different directories. */
+    base = launcher + strlen(launcher);
+    while (base > launcher && base[-1] != '/' && base[-1] != '\\') {
+        base--;
+    }
+    if (chaz_Make.shell_type == CHAZ_OS_POSIX
+        && strncmp(base, "ccache", 6) == 0
+       ) {
+        char *tmp = chaz_Util_join(" ", "CCACHE_BASEDIR=\"$$PWD\"", launcher,
+                                   NULL);
+        free(launcher);
+        launcher = tmp;
+    }
+
+    return launcher;
+}
+
+static int
+S_chaz_Make_build_timing(void) {
+    if (chaz_Make.timing == 0) {
+        chaz_Make.timing = -1;
+        if (chaz_Make.cli && chaz_CLI_defined(chaz_Make.cli, "build-timing")) {
+            if (chaz_CC_compile_exe("_charm_build_timer.c", "build-timer",
+                                    chaz_Make_build_timer_code)) {
+                chaz_Make.timing = 1;
+            }
+            else {
+                chaz_Util_warn("Failed to compile build timer");
+            }
+        }
     }
 
-    chaz_CFlags_destroy(output_cflags);
+    return chaz_Make.timing > 0;
 }
 
-static void
-S_chaz_MakeFile_write_pattern_rules(char **dirs, const char *cflags,
-                                    FILE *out) {
-    const char *cc = chaz_CC_is_msvc() ? "$(CC) /nologo" : "$(CC)";
-    const char *obj_ext = chaz_CC_obj_ext();
-    const char *dir_sep = chaz_OS_dir_sep();
-    chaz_CFlags *output_cflags = chaz_CC_new_cflags();
-    const char *output_cflags_string;
-    char *command;
-    size_t i;
+static chaz_MakeRule*
+S_chaz_Make_build_report_rule(void) {
+    chaz_MakeRule *rule;
 
-    chaz_CFlags_set_output_obj(output_cflags, "$@");
-    output_cflags_string = chaz_CFlags_get_string(output_cflags);
-    command  = chaz_Util_join(" ", cc, "$(CFLAGS)", cflags, "$<",
-                              output_cflags_string, NULL);
+    if (!S_chaz_Make_build_timing()) { return NULL; }
 
-    for (i = 0; dirs[i]; i++) {
-        const char *dir = dirs[i];
-        char *target = chaz_Util_join("", dir, dir_sep, "%", obj_ext,
-                                      NULL);
-        char *prereq = chaz_Util_join("", dir, dir_sep, "%.c", NULL);
-        chaz_MakeRule *rule = S_chaz_MakeRule_new(target, prereq);
+    rule = S_chaz_MakeRule_new("build-report", NULL);
+    chaz_MakeRule_add_command(rule, "$(BUILD_TIMER) --report");
+    return rule;
+}
 
-        chaz_MakeRule_add_command(rule, command);
-        S_chaz_MakeRule_write(rule, out);
+static char*
+S_chaz_Make_build_timer_var(void) {
+    const char *prefix = chaz_Make.shell_type == CHAZ_OS_POSIX ? "./" : "";
 
-        S_chaz_MakeRule_destroy(rule);
-        free(prereq);
-        free(target);
+    return chaz_Util_join("", prefix, "build-timer", chaz_CC_exe_ext(),
+                          " build-timing.log", NULL);
+}
+
+static char*
+S_chaz_MakeFile_compile_command(const char *cflags, const char *source) {
+    chaz_CFlags *command_flags = chaz_CC_new_cflags();
+    char *command;
+
+    if (S_chaz_Make_build_timing()) {
+        chaz_CFlags_append(command_flags, "$(BUILD_TIMER) $@");
+    }
+    if (chaz_Make.launcher) {
+        chaz_CFlags_append(command_flags, "$(CC_LAUNCHER)");
+    }
+    chaz_CFlags_append(command_flags,
+                       chaz_CC_is_msvc() ? "$(CC) /nologo" : "$(CC)");
+    chaz_CFlags_append(command_flags, "$(CFLAGS)");
+    if (cflags) {
+        chaz_CFlags_append(command_flags, cflags);
+    }
+    if (chaz_Make.pgo) {
+        chaz_CFlags_append(command_flags, "$(PGO_CFLAGS)");
     }
+    if (chaz_Make.variants) {
+        chaz_CFlags_append(command_flags, "$(VARIANT_CFLAGS)");
+    }
+    if (chaz_Make.dep_files) {
+        chaz_CFlags_append(command_flags, "$(DEPFLAGS)");
+    }
+    chaz_CFlags_append(command_flags, source);
+    chaz_CFlags_set_output_obj(command_flags, "$@");
 
-    free(command);
-    chaz_CFlags_destroy(output_cflags);
+    command = chaz_Util_strdup(chaz_CFlags_get_string(command_flags));
+    chaz_CFlags_destroy(command_flags);
+    return command;
 }
 
 void
 chaz_MakeVar_append(chaz_MakeVar *self, const char *element) {
-    char *value;
-
     if (element[0] == '\0') { return; }
 
-    if (self->num_elements == 0) {
-        value = chaz_Util_strdup(element);
+    if (self->num_elements == 1) {
+        /* Move the first element to its own line. */
+        chaz_Buf value;
+        chaz_Buf_init(&value);
+        chaz_Buf_append(&value, "\\\n    ");
+        chaz_Buf_append_len(&value, self->value.ptr, self->value.len);
+        chaz_Buf_clear(&self->value);
+        self->value = value;
     }
-    else {
-        value = (char*)malloc(strlen(self->value) + strlen(element) + 20);
-
-        if (self->num_elements == 1) {
-            sprintf(value, "\\\n    %s \\\n    %s", self->value, element);
-        }
-        else {
-            sprintf(value, "%s \\\n    %s", self->value, element);
-        }
+    if (self->num_elements > 0) {
+        chaz_Buf_append(&self->value, " \\\n    ");
     }
-
-    free(self->value);
-    self->value = value;
+    chaz_Buf_append(&self->value, element);
     self->num_elements++;
 }
 
@@ -1070,9 +3239,9 @@ static chaz_MakeRule*
 S_chaz_MakeRule_new(const char *target, const char *prereq) {
     chaz_MakeRule *rule = (chaz_MakeRule*)malloc(sizeof(chaz_MakeRule));
 
-    rule->targets  = NULL;
-    rule->prereqs  = NULL;
-    rule->commands = NULL;
+    chaz_Buf_init(&rule->targets);
+    chaz_Buf_init(&rule->prereqs);
+    chaz_Buf_init(&rule->commands);
 
     if (target) { chaz_MakeRule_add_target(rule, target); }
     if (prereq) { chaz_MakeRule_add_prereq(rule, prereq); }
@@ -1082,70 +3251,68 @@ S_chaz_MakeRule_new(const char *target, const char *prereq) {
 
 static void
 S_chaz_MakeRule_destroy(chaz_MakeRule *self) {
-    if (self->targets)  { free(self->targets); }
-    if (self->prereqs)  { free(self->prereqs); }
-    if (self->commands) { free(self->commands); }
+    chaz_Buf_clear(&self->targets);
+    chaz_Buf_clear(&self->prereqs);
+    chaz_Buf_clear(&self->commands);
     free(self);
 }
 
 static void
 S_chaz_MakeRule_write(chaz_MakeRule *self, FILE *out) {
-    fprintf(out, "%s :", self->targets);
-    if (self->prereqs) {
-        fprintf(out, " %s", self->prereqs);
+    fprintf(out, "%s :", self->targets.ptr);
+    if (self->prereqs.ptr) {
+        fprintf(out, " %s", self->prereqs.ptr);
     }
     fprintf(out, "\n");
-    if (self->commands) {
-        fprintf(out, "%s", self->commands);
+    if (self->commands.ptr) {
+        fprintf(out, "%s", self->commands.ptr);
     }
     fprintf(out, "\n");
 }
 
+static void
+S_chaz_MakeRule_replace_in_commands(chaz_MakeRule *self, const char *from,
+                                    const char *to) {
+    size_t    from_len = strlen(from);
+    char     *start    = self->commands.ptr;
+    char     *match;
+    chaz_Buf  commands;
+
+    if (start == NULL) { return; }
+
+    chaz_Buf_init(&commands);
+    while (NULL != (match = strstr(start, from))) {
+        chaz_Buf_append_len(&commands, start, (size_t)(match - start));
+        chaz_Buf_append(&commands, to);
+        start = match + from_len;
+    }
+    chaz_Buf_append(&commands, start);
+
+    chaz_Buf_clear(&self->commands);
+    self->commands = commands;
+}
+
 void
 chaz_MakeRule_add_target(chaz_MakeRule *self, const char *target) {
-    char *targets;
-
-    if (!self->targets) {
-        targets = chaz_Util_strdup(target);
-    }
-    else {
-        targets = chaz_Util_join(" ", self->targets, target, NULL);
-        free(self->targets);
+    if (self->targets.ptr) {
+        chaz_Buf_append(&self->targets, " ");
     }
-
-    self->targets = targets;
+    chaz_Buf_append(&self->targets, target);
 }
 
 void
 chaz_MakeRule_add_prereq(chaz_MakeRule *self, const char *prereq) {
-    char *prereqs;
-
-    if (!self->prereqs) {
-        prereqs = chaz_Util_strdup(prereq);
-    }
-    else {
-        prereqs = chaz_Util_join(" ", self->prereqs, prereq, NULL);
-        free(self->prereqs);
+    if (self->prereqs.ptr) {
+        chaz_Buf_append(&self->prereqs, " ");
     }
-
-    self->prereqs = prereqs;
+    chaz_Buf_append(&self->prereqs, prereq);
 }
 
 void
 chaz_MakeRule_add_command(chaz_MakeRule *self, const char *command) {
-    char *commands;
-
-    if (!self->commands) {
-        commands = (char*)malloc(strlen(command) + 20);
-        sprintf(commands, "\t%s\n", command);
-    }
-    else {
-        commands = (char*)malloc(strlen(self->commands) + strlen(command) + 20);
-        sprintf(commands, "%s\t%s\n", self->commands, command);
-        free(self->commands);
-    }
-
-    self->commands = commands;
+    chaz_Buf_append(&self->commands, "\t");
+    chaz_Buf_append(&self->commands, command);
+    chaz_Buf_append(&self->commands, "\n");
 }
 
 void
@@ -1237,6 +3404,22 @@ chaz_MakeRule_add_make_command(chaz_MakeRule *self, const char *dir,
     free(command);
 }
 
+static char**
+S_chaz_Make_list_push(char **list, size_t *num_elements, char *element) {
+    size_t num = *num_elements;
+
+    /* The capacity is the smallest power of two that can hold the
+     * elements and the terminating NULL. */
+    if (((num + 1) & num) == 0) {
+        list = (char**)realloc(list, 2 * (num + 1) * sizeof(char*));
+    }
+    list[num]     = element;
+    list[num+1]   = NULL;
+    *num_elements = num + 1;
+
+    return list;
+}
+
 static void
 S_chaz_MakeBinary_destroy(chaz_MakeBinary *self) {
     size_t i;
@@ -1252,6 +3435,13 @@ S_chaz_MakeBinary_destroy(chaz_MakeBinary *self) {
         free(self->single_sources[i]);
     }
     free(self->single_sources);
+    for (i = 0; i < self->num_flagged_sources; i++) {
+        free(self->flagged_sources[i]);
+        free(self->flagged_cflags[i]);
+    }
+    free(self->flagged_sources);
+    free(self->flagged_cflags);
+    free(self->groups);
     for (i = 0; i < self->num_dirs; i++) {
         free(self->dirs[i]);
     }
@@ -1260,15 +3450,16 @@ S_chaz_MakeBinary_destroy(chaz_MakeBinary *self) {
     chaz_CFlags_destroy(self->cflags);
     chaz_CFlags_destroy(self->ldflags);
 
+    free(self->pch_header);
+    free(self->pch_file);
+    free(self->pch_flags);
+
     free(self);
 }
 
 void
 chaz_MakeBinary_add_src_file(chaz_MakeBinary *self, const char *dir,
                              const char *filename) {
-    size_t num_sources = self->num_single_sources;
-    size_t alloc_size  = (num_sources + 2) * sizeof(char*);
-    char **sources = (char**)realloc(self->single_sources, alloc_size);
     char *path;
 
     if (dir == NULL || strcmp(dir, ".") == 0) {
@@ -1280,14 +3471,50 @@ chaz_MakeBinary_add_src_file(chaz_MakeBinary *self, const char *dir,
     }
 
     /* Add to single_sources. */
-    sources[num_sources]     = path;
-    sources[num_sources+1]   = NULL;
-    self->single_sources     = sources;
-    self->num_single_sources = num_sources + 1;
+    self->single_sources = S_chaz_Make_list_push(self->single_sources,
+                                                 &self->num_single_sources,
+                                                 path);
 
     S_chaz_MakeBinary_do_add_src_file(self, path);
 }
 
+void
+chaz_MakeBinary_add_src_file_with_flags(chaz_MakeBinary *self,
+                                        const char *dir,
+                                        const char *filename,
+                                        const char *cflags) {
+    size_t num_cflags = self->num_flagged_sources;
+    char  *path;
+    size_t i;
+
+    if (dir == NULL || strcmp(dir, ".") == 0) {
+        path = chaz_Util_strdup(filename);
+    }
+    else {
+        const char *dir_sep = chaz_OS_dir_sep();
+        path = chaz_Util_join(dir_sep, dir, filename, NULL);
+    }
+
+    if (S_chaz_MakeBinary_flagged_index(self, path) >= 0) {
+        chaz_Util_die("Source file added twice with flags: %s", path);
+    }
+
+    /* The file may already have been found in a source directory. */
+    for (i = 0; i < self->num_sources; i++) {
+        if (strcmp(self->sources[i], path) == 0) { break; }
+    }
+    if (i == self->num_sources) {
+        S_chaz_MakeBinary_do_add_src_file(self, path);
+    }
+
+    self->flagged_sources = S_chaz_Make_list_push(self->flagged_sources,
+                                                  &self->num_flagged_sources,
+                                                  path);
+    self->flagged_cflags = S_chaz_Make_list_push(self->flagged_cflags,
+                                                 &num_cflags,
+                                                 chaz_Util_strdup(cflags));
+}
+
 void
 chaz_MakeBinary_add_src_dir(chaz_MakeBinary *self, const char *path) {
     chaz_MakeBinary_add_filtered_src_dir(self, path, NULL, NULL);
@@ -1298,13 +3525,9 @@ chaz_MakeBinary_add_filtered_src_dir(chaz_MakeBinary *self, const char *path,
                                      chaz_Make_file_filter_t filter,
                                      void *filter_ctx) {
     chaz_MakeBinaryContext context;
-    size_t num_dirs = self->num_dirs;
-    char **dirs = (char**)realloc(self->dirs, (num_dirs + 2) * sizeof(char*));
 
-    dirs[num_dirs]   = chaz_Util_strdup(path);
-    dirs[num_dirs+1] = NULL;
-    self->dirs     = dirs;
-    self->num_dirs = num_dirs + 1;
+    self->dirs = S_chaz_Make_list_push(self->dirs, &self->num_dirs,
+                                       chaz_Util_strdup(path));
 
     context.binary     = self;
     context.filter     = filter;
@@ -1324,22 +3547,20 @@ S_chaz_MakeBinary_list_files_callback(const char *dir, char *file,
         || context->filter(dir, file, context->filter_ctx) != 0
        ) {
         char *path = chaz_Util_join(dir_sep, dir, file, NULL);
-        S_chaz_MakeBinary_do_add_src_file(context->binary, path);
+        /* Sources with their own flags may have been added already. */
+        if (S_chaz_MakeBinary_flagged_index(context->binary, path) < 0) {
+            S_chaz_MakeBinary_do_add_src_file(context->binary, path);
+        }
         free(path);
     }
 }
 
 static void
 S_chaz_MakeBinary_do_add_src_file(chaz_MakeBinary *self, const char *path) {
-    size_t num_sources = self->num_sources;
-    size_t alloc_size  = (num_sources + 2) * sizeof(char*);
-    char **sources = (char**)realloc(self->sources, alloc_size);
     char *obj_path;
 
-    sources[num_sources]   = chaz_Util_strdup(path);
-    sources[num_sources+1] = NULL;
-    self->sources     = sources;
-    self->num_sources = num_sources + 1;
+    self->sources = S_chaz_Make_list_push(self->sources, &self->num_sources,
+                                          chaz_Util_strdup(path));
 
     obj_path = S_chaz_MakeBinary_obj_path(path);
     if (obj_path == NULL) {
@@ -1351,6 +3572,27 @@ S_chaz_MakeBinary_do_add_src_file(chaz_MakeBinary *self, const char *path) {
     }
 }
 
+static int
+S_chaz_MakeBinary_flagged_index(chaz_MakeBinary *self, const char *source) {
+    size_t i;
+
+    for (i = 0; i < self->num_flagged_sources; i++) {
+        if (strcmp(self->flagged_sources[i], source) == 0) {
+            return (int)i;
+        }
+    }
+
+    return -1;
+}
+
+static char*
+S_chaz_MakeBinary_flagged_cflags(chaz_MakeBinary *self, int index) {
+    /* The precompiled header is skipped because it was compiled with
+     * different flags. */
+    return chaz_Util_join("", "$(", self->cflags_var->name, ") ",
+                          self->flagged_cflags[index], NULL);
+}
+
 static char*
 S_chaz_MakeBinary_obj_path(const char *src_path) {
     const char *dir_sep = chaz_OS_dir_sep();
@@ -1358,6 +3600,7 @@ S_chaz_MakeBinary_obj_path(const char *src_path) {
     size_t obj_ext_len = strlen(obj_ext);
     size_t i = strlen(src_path);
     char *retval;
+    char *tmp;
 
     while (i > 0) {
         i -= 1;
@@ -1371,9 +3614,346 @@ S_chaz_MakeBinary_obj_path(const char *src_path) {
     memcpy(retval, src_path, i);
     memcpy(retval + i, obj_ext, obj_ext_len + 1);
 
+    /* Mirror the source tree in the build directory. */
+    if (S_chaz_Make_builddir()) {
+        tmp = S_chaz_Make_builddir_path(retval);
+        free(retval);
+        retval = tmp;
+    }
+
     return retval;
 }
 
+void
+chaz_MakeBinary_set_unity_batches(chaz_MakeBinary *self, int num_batches,
+                                  chaz_Make_file_filter_t filter,
+                                  void *context) {
+    self->num_unity_batches = num_batches;
+    self->unity_filter      = filter;
+    self->unity_filter_ctx  = context;
+}
+
+static int*
+S_chaz_MakeBinary_unity_batches(chaz_MakeBinary *self, int *num_batches) {
+    const char *dir_sep = chaz_OS_dir_sep();
+    int    *batches;
+    size_t  num_candidates = 0;
+    size_t  batch_size;
+    size_t  i;
+
+    *num_batches = 0;
+    if (self->num_unity_batches <= 0) { return NULL; }
+
+    batches = (int*)malloc((self->num_sources + 1) * sizeof(int));
+
+    for (i = 0; i < self->num_sources; i++) {
+        const char *source = self->sources[i];
+        int include = 1;
+
+        if (self->unity_filter) {
+            /* Split path into directory and filename for the filter. */
+            char *dir  = chaz_Util_strdup(source);
+            char *file = strrchr(dir, dir_sep[0]);
+            if (file) {
+                *file++ = '\0';
+                include = self->unity_filter(dir, file,
+                                             self->unity_filter_ctx);
+            }
+            else {
+                include = self->unity_filter(".", dir,
+                                             self->unity_filter_ctx);
+            }
+            free(dir);
+        }
+
+        /* Flags of single sources must not leak into a batch. */
+        if (S_chaz_MakeBinary_flagged_index(self, source) >= 0) {
+            include = 0;
+        }
+
+        batches[i] = include ? 0 : -1;
+        if (include) { num_candidates++; }
+    }
+
+    if (num_candidates == 0) {
+        free(batches);
+        return NULL;
+    }
+
+    /* Split candidates into contiguous batches so that files from the
+     * same directory tend to end up in the same batch. */
+    batch_size = (num_candidates + self->num_unity_batches - 1)
+                 / self->num_unity_batches;
+    num_candidates = 0;
+    for (i = 0; i < self->num_sources; i++) {
+        if (batches[i] < 0) { continue; }
+        batches[i] = (int)(num_candidates / batch_size);
+        num_candidates++;
+    }
+    *num_batches = (int)((num_candidates + batch_size - 1) / batch_size);
+
+    return batches;
+}
+
+static char*
+S_chaz_MakeBinary_unity_path(chaz_MakeBinary *self, int batch) {
+    char suffix[30];
+    sprintf(suffix, "_unity%d.c", batch);
+    return S_chaz_MakeBinary_generated_path(self, suffix);
+}
+
+static char*
+S_chaz_MakeBinary_generated_path(chaz_MakeBinary *self, const char *suffix) {
+    const char *var_name = self->obj_var->name;
+    size_t      base_len = strlen(var_name) - (sizeof("_OBJS") - 1);
+    char       *path     = (char*)malloc(base_len + strlen(suffix) + 1);
+    size_t      i;
+
+    for (i = 0; i < base_len; i++) {
+        path[i] = tolower((unsigned char)var_name[i]);
+    }
+    strcpy(path + base_len, suffix);
+
+    return path;
+}
+
+static char*
+S_chaz_MakeBinary_msvc_pch_path(chaz_MakeBinary *self) {
+    char *path = S_chaz_MakeBinary_generated_path(self, ".pch");
+
+    if (S_chaz_Make_builddir()) {
+        char *tmp = S_chaz_Make_builddir_path(path);
+        free(path);
+        path = tmp;
+    }
+
+    return path;
+}
+
+int
+chaz_MakeBinary_add_pch(chaz_MakeBinary *self, const char *header) {
+    free(self->pch_header);
+    free(self->pch_file);
+    free(self->pch_flags);
+    self->pch_header = NULL;
+    self->pch_file   = NULL;
+    self->pch_flags  = NULL;
+
+    if (chaz_CC_is_msvc()) {
+        char *pch = S_chaz_MakeBinary_msvc_pch_path(self);
+        char *stub = S_chaz_MakeBinary_generated_path(self, "_pch.c");
+        self->pch_file  = S_chaz_MakeBinary_obj_path(stub);
+        self->pch_flags = chaz_Util_join("", "/Yu\"", header, "\" /Fp", pch,
+                                         " /FI\"", header, "\"", NULL);
+        free(stub);
+        free(pch);
+    }
+    else if (chaz_CC_is_clang()) {
+        if (S_chaz_Make_builddir()) {
+            char *path = chaz_Util_join("", header, ".pch", NULL);
+            self->pch_file = S_chaz_Make_builddir_path(path);
+            free(path);
+        }
+        else {
+            self->pch_file = chaz_Util_join("", header, ".pch", NULL);
+        }
+        self->pch_flags = chaz_Util_join(" ", "-include-pch", self->pch_file,
+                                         NULL);
+    }
+    else if (chaz_CC_is_gcc()) {
+        /* GCC uses header.h.gch instead of a force-included header.h, even
+         * if header.h itself doesn't exist. Only the force-include refers
+         * to the build directory, so the lookup of other headers doesn't
+         * change. */
+        char *path = S_chaz_Make_builddir()
+                     ? S_chaz_Make_builddir_path(header)
+                     : chaz_Util_strdup(header);
+        self->pch_file  = chaz_Util_join("", path, ".gch", NULL);
+        self->pch_flags = chaz_Util_join(" ", "-include", path, NULL);
+        free(path);
+    }
+    else {
+        return 0;
+    }
+
+    self->pch_header = chaz_Util_strdup(header);
+    return 1;
+}
+
+int
+chaz_MakeBinary_enable_lto(chaz_MakeBinary *self, int mode) {
+    if (!chaz_CFlags_enable_lto(self->cflags, mode)) { return 0; }
+
+    if (self->type == CHAZ_MAKEBINARY_STATIC_LIB) {
+        /* Recreate the archiver command with LTO tools. */
+        self->lto_tools = 1;
+        S_chaz_MakeBinary_set_archiver_command(self);
+    }
+    else {
+        chaz_CFlags_link_lto(self->ldflags, mode);
+        self->lto = 1;
+
+        if (!chaz_CC_is_msvc()) {
+            /* The '+' prefix makes make pass its jobserver to the
+             * linker even though the command isn't a recursive make. */
+            const char *link = "\t$(LINK)";
+            chaz_Buf   *buf  = &self->rule->commands;
+            char       *pos  = buf->ptr ? strstr(buf->ptr, link) : NULL;
+            if (pos) {
+                size_t   prefix_len = (size_t)(pos - buf->ptr) + 1;
+                chaz_Buf commands;
+                chaz_Buf_init(&commands);
+                chaz_Buf_append_len(&commands, buf->ptr, prefix_len);
+                chaz_Buf_append(&commands, "+");
+                chaz_Buf_append(&commands, pos + 1);
+                chaz_Buf_clear(buf);
+                *buf = commands;
+            }
+        }
+    }
+
+    return 1;
+}
+
+int
+chaz_MakeBinary_split_debug_info(chaz_MakeBinary *self) {
+    if (!chaz_CFlags_split_debug_info(self->cflags)) { return 0; }
+    self->split_dwarf = 1;
+    return 1;
+}
+
+int
+chaz_MakeBinary_enable_section_gc(chaz_MakeBinary *self) {
+    if (!chaz_CFlags_enable_section_gc(self->cflags)) { return 0; }
+    if (self->type == CHAZ_MAKEBINARY_EXE
+        || self->type == CHAZ_MAKEBINARY_SHARED_LIB
+       ) {
+        return chaz_CFlags_link_section_gc(self->ldflags);
+    }
+    return 1;
+}
+
+int
+chaz_MakeBinary_optimize_dynamic_loading(chaz_MakeBinary *self) {
+    if ((self->type != CHAZ_MAKEBINARY_EXE
+         && self->type != CHAZ_MAKEBINARY_SHARED_LIB)
+        || chaz_CC_binary_format() != CHAZ_CC_BINFMT_ELF
+        || chaz_CC_is_msvc()
+       ) {
+        return 0;
+    }
+
+    /* The link flags are added when finalizing because they must precede
+     * libraries and depend on whether symbols are hidden. */
+    self->optimize_loading = 1;
+    if (self->type == CHAZ_MAKEBINARY_SHARED_LIB) {
+        chaz_CFlags_disable_semantic_interposition(self->cflags);
+    }
+    return 1;
+}
+
+int
+chaz_MakeBinary_use_fast_linker(chaz_MakeBinary *self) {
+    if (self->type != CHAZ_MAKEBINARY_EXE
+        && self->type != CHAZ_MAKEBINARY_SHARED_LIB
+       ) {
+        return 0;
+    }
+    return chaz_CFlags_use_fast_linker(self->ldflags);
+}
+
+int
+chaz_MakeBinary_use_response_file(chaz_MakeBinary *self) {
+    /* Only these toolchains are known to read '@file' arguments. */
+    if (!chaz_CC_is_gcc() && !chaz_CC_is_clang() && !chaz_CC_is_msvc()) {
+        return 0;
+    }
+    if (self->type == CHAZ_MAKEBINARY_OBJECT_GROUP) { return 0; }
+    /* Darwin's ar doesn't support response files. */
+    if (self->type == CHAZ_MAKEBINARY_STATIC_LIB
+        && chaz_CC_binary_format() == CHAZ_CC_BINFMT_MACHO
+       ) {
+        return 0;
+    }
+
+    self->response_file = 1;
+    return 1;
+}
+
+int
+chaz_MakeBinary_use_thin_archive(chaz_MakeBinary *self) {
+    char *command;
+
+    if (self->type != CHAZ_MAKEBINARY_STATIC_LIB) { return 0; }
+
+    /* An installed thin archive would reference objects in the build
+     * tree, so keep building a normal archive. */
+    if (self->installed) { return 0; }
+
+    command = chaz_CC_format_thin_archiver_command("$@", "", 0);
+    if (command == NULL) { return 0; }
+    free(command);
+
+    self->thin_archive = 1;
+    S_chaz_MakeBinary_set_archiver_command(self);
+    return 1;
+}
+
+static void
+S_chaz_MakeBinary_set_archiver_command(chaz_MakeBinary *self) {
+    char *command;
+
+    chaz_Buf_clear(&self->rule->commands);
+    if (self->thin_archive) {
+        /* Start from scratch because ar can't convert a normal archive to
+         * a thin one and to drop members of removed sources. */
+        chaz_MakeRule_add_rm_command(self->rule, "$@");
+        command = chaz_CC_format_thin_archiver_command("$@",
+                                                       self->obj_dollar_var,
+                                                       self->lto_tools);
+    }
+    else if (self->lto_tools) {
+        command = chaz_CC_format_lto_archiver_command("$@",
+                                                      self->obj_dollar_var);
+    }
+    else {
+        command = chaz_CC_format_archiver_command("$@", self->obj_dollar_var);
+    }
+    chaz_MakeRule_add_command(self->rule, command);
+    free(command);
+}
+
+static char*
+S_chaz_MakeBinary_obj_cflags(chaz_MakeBinary *self) {
+    if (self->pch_flags) {
+        return chaz_Util_join("", "$(", self->cflags_var->name, ") ",
+                              self->pch_flags, NULL);
+    }
+    return chaz_Util_join("", "$(", self->cflags_var->name, ")", NULL);
+}
+
+void
+chaz_MakeBinary_add_object_group(chaz_MakeBinary *self,
+                                 chaz_MakeBinary *group) {
+    size_t alloc_size;
+
+    if (group->type != CHAZ_MAKEBINARY_OBJECT_GROUP
+        || self->type == CHAZ_MAKEBINARY_OBJECT_GROUP
+       ) {
+        chaz_Util_die("Only object groups can be added to binaries");
+    }
+
+    if (self->type == CHAZ_MAKEBINARY_SHARED_LIB && !group->pic) {
+        /* PIC objects work in static libraries and executables, too. */
+        chaz_CFlags_compile_shared_library(group->cflags);
+        group->pic = 1;
+    }
+
+    alloc_size   = (self->num_groups + 1) * sizeof(chaz_MakeBinary*);
+    self->groups = (chaz_MakeBinary**)realloc(self->groups, alloc_size);
+    self->groups[self->num_groups++] = group;
+}
+
 void
 chaz_MakeBinary_add_prereq(chaz_MakeBinary *self, const char *prereq) {
     chaz_MakeRule_add_prereq(self->rule, prereq);
@@ -1381,29 +3961,75 @@ chaz_MakeBinary_add_prereq(chaz_MakeBinary *self, const char *prereq) {
 
 char*
 chaz_MakeBinary_obj_string(chaz_MakeBinary *self) {
-    char *retval = chaz_Util_strdup("");
+    char *retval = S_chaz_MakeBinary_src_obj_string(self);
     size_t i;
 
-    for (i = 0; i < self->num_sources; i++) {
-        const char *sep = retval[0] == '\0' ? "" : " ";
-        char *obj_path = S_chaz_MakeBinary_obj_path(self->sources[i]);
-        char *tmp;
+    if (self->pch_file && chaz_CC_is_msvc()) {
+        /* The object created with the PCH must be linked, too. */
+        char *tmp = chaz_Util_join(" ", retval, self->pch_file, NULL);
+        free(retval);
+        retval = tmp;
+    }
 
-        if (obj_path == NULL) { continue; }
+    for (i = 0; i < self->num_groups; i++) {
+        char *group_objs = chaz_MakeBinary_obj_string(self->groups[i]);
+        char *tmp;
 
-        tmp = chaz_Util_join("", retval, sep, obj_path, NULL);
+        if (group_objs[0] == '\0') {
+            free(group_objs);
+            continue;
+        }
+        tmp = retval[0] == '\0'
+              ? chaz_Util_strdup(group_objs)
+              : chaz_Util_join(" ", retval, group_objs, NULL);
+        free(group_objs);
         free(retval);
         retval = tmp;
+    }
+
+    return retval;
+}
 
+static char*
+S_chaz_MakeBinary_src_obj_string(chaz_MakeBinary *self) {
+    chaz_Buf retval;
+    int  *batches;
+    int   num_batches;
+    int   batch;
+    size_t i;
+
+    chaz_Buf_init(&retval);
+    batches = S_chaz_MakeBinary_unity_batches(self, &num_batches);
+    for (batch = 0; batch < num_batches; batch++) {
+        char *path = S_chaz_MakeBinary_unity_path(self, batch);
+        char *obj_path = S_chaz_MakeBinary_obj_path(path);
+        if (retval.len != 0) { chaz_Buf_append(&retval, " "); }
+        chaz_Buf_append(&retval, obj_path);
         free(obj_path);
+        free(path);
     }
 
-    return retval;
+    for (i = 0; i < self->num_sources; i++) {
+        char *obj_path;
+
+        if (batches && batches[i] >= 0) { continue; }
+
+        obj_path = S_chaz_MakeBinary_obj_path(self->sources[i]);
+        if (obj_path == NULL) { continue; }
+
+        if (retval.len != 0) { chaz_Buf_append(&retval, " "); }
+        chaz_Buf_append(&retval, obj_path);
+
+        free(obj_path);
+    }
+
+    free(batches);
+    return chaz_Buf_yield(&retval);
 }
 
 const char*
 chaz_MakeBinary_get_target(chaz_MakeBinary *self) {
-    return self->rule->targets;
+    return self->rule->targets.ptr;
 }
 
 chaz_CFlags*
@@ -1429,6 +4055,11 @@ chaz_Make_list_files(const char *dir, const char *ext,
     size_t      list_len;
     size_t      prefix_len;
 
+    /* Walk the directory natively if possible. */
+    if (chaz_OS_list_files(dir, ext, callback, context)) {
+        return;
+    }
+
     /* List files using shell. */
 
     if (shell_type == CHAZ_OS_POSIX) {
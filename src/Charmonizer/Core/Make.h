@@ -59,6 +59,20 @@ chaz_Make_get_make(void);
 int
 chaz_Make_shell_type(void);
 
+/** Return the path of a directory in the build directory. If a build
+ * directory was specified with `--builddir`, the path is prefixed with
+ * `$(BUILDDIR)`. Objects and binaries are placed in the build directory,
+ * so this is useful to reference them, for example when adding library
+ * paths. Parent directory components like `..` are mapped to `__` and
+ * absolute paths below `_root`, so that objects of sources outside the
+ * source tree stay in the build directory.
+ *
+ * @param dir A directory relative to the build directory or NULL.
+ * @return A newly allocated string.
+ */
+char*
+chaz_Make_build_dir(const char *dir);
+
 /** Recursively list files in a directory. For every file a callback is called
  * with the filename and a context variable.
  *
@@ -119,6 +133,19 @@ chaz_MakeFile_clean_rule(chaz_MakeFile *self);
 chaz_MakeRule*
 chaz_MakeFile_distclean_rule(chaz_MakeFile *self);
 
+/** Merge another MakeFile into this one to create a single, non-recursive
+ * Makefile. Variables, rules and binaries are moved and the commands of
+ * the install, clean and distclean targets are appended. Unlike recursive
+ * make calls with `chaz_MakeRule_add_make_command`, this exposes the full
+ * dependency graph to a single make process.
+ *
+ * Paths in [other] must be relative to the directory of the resulting
+ * Makefile, and its variable names must be unique. [other] is destroyed.
+ * Both MakeFiles must not have been written yet.
+ */
+void
+chaz_MakeFile_merge(chaz_MakeFile *self, chaz_MakeFile *other);
+
 /** Add an executable. Returns a chaz_MakeBinary object.
  *
  * @param dir The target directory or NULL for the current directory.
@@ -154,6 +181,18 @@ chaz_MakeBinary*
 chaz_MakeFile_add_static_lib(chaz_MakeFile *self, const char *dir,
                              const char *basename, int installed);
 
+/** Add an object group. An object group compiles its sources only once
+ * and its objects can be linked into several binaries with
+ * chaz_MakeBinary_add_object_group, for example into both a shared and a
+ * static library or into many test executables. Sources, compile flags,
+ * unity batches and precompiled headers are configured like for other
+ * binaries. Returns a chaz_MakeBinary object.
+ *
+ * @param basename The name of the group.
+ */
+chaz_MakeBinary*
+chaz_MakeFile_add_object_group(chaz_MakeFile *self, const char *basename);
+
 /** Add a rule to build the lemon parser generator.
  *
  * @param dir The lemon directory.
@@ -203,11 +242,66 @@ void
 chaz_MakeFile_install_pkgconfig(chaz_MakeFile *self, const char *name,
                                 const char *version, const char *content);
 
+/** Add a command that runs a training workload for profile-guided
+ * optimization. If training commands were added, the following targets
+ * are written for GCC and Clang:
+ *
+ * - `pgo-generate`: Rebuild all binaries with instrumentation.
+ * - `pgo-train`: Run pgo-generate and the training commands.
+ * - `pgo-use`: Rebuild all binaries using the collected profile.
+ *
+ * A full build runs `make pgo-train` followed by `make pgo-use`. Since
+ * pgo-use doesn't depend on pgo-train, an existing profile can be reused
+ * without retraining. Profile data is stored in `$(PGO_DIR)` which is
+ * removed by the clean target. The training commands are run in the
+ * directory of the makefile.
+ *
+ * @param command The training command.
+ */
+void
+chaz_MakeFile_add_pgo_training(chaz_MakeFile *self, const char *command);
+
+/** Add a build variant. Running `make [name]` rebuilds all binaries in the
+ * directory `variants/[name]` below the build directory, adding the
+ * returned flags to all compile and link commands. This way, flavours
+ * like debug and release builds share a single configure run. The flags
+ * are added after the base flags, including those from `--cflags`, so
+ * flags where the last one wins, like optimization levels, override the
+ * base flags. Variants must be added before any binaries. The variant
+ * directories are removed by the clean target. Variants of merged
+ * MakeFiles are combined by name.
+ *
+ * @param name The name of the variant and its make target.
+ * @return The flags of the variant which are owned by the makefile.
+ */
+chaz_CFlags*
+chaz_MakeFile_add_variant(chaz_MakeFile *self, const char *name);
+
+/** Add the variants `debug`, `release` and `profile`, and `coverage` with
+ * GCC and Clang. The `debug` variant turns optimization off. This is done
+ * automatically if `--build-variants` was specified.
+ */
+void
+chaz_MakeFile_add_default_variants(chaz_MakeFile *self);
+
 /** Write the makefile to a file named 'Makefile' in the current directory.
+ * If `--enable-ninja` was specified, a 'build.ninja' file is written as
+ * well.
  */
 void
 chaz_MakeFile_write(chaz_MakeFile *self);
 
+/** Write the rules to a file named 'build.ninja' in the current directory.
+ * Make variables are expanded when the file is written. Variables that
+ * make would take from the environment, like `CFLAGS`, become ninja
+ * variables which can be set in a file that includes 'build.ninja'. Header
+ * dependencies are tracked with ninja's 'deps' feature, custom rules use
+ * 'restat' and LTO links are run one at a time in a pool. The targets for
+ * profile-guided optimization are only supported in Makefiles.
+ */
+void
+chaz_MakeFile_write_ninja(chaz_MakeFile *self);
+
 /** Append content to a makefile variable. The new content will be separated
  * from the existing content with whitespace.
  *
@@ -276,6 +370,23 @@ void
 chaz_MakeBinary_add_src_file(chaz_MakeBinary *self, const char *dir,
                              const char *filename);
 
+/** Add a source file that is compiled with additional flags, for example
+ * to enable instruction set extensions for a runtime-dispatched kernel.
+ * The flags are appended to the binary's compile flags for this file only.
+ * The file is excluded from unity batches and doesn't use a precompiled
+ * header. If the file is also found in a source directory of the binary,
+ * it's only compiled once, with the additional flags.
+ *
+ * @param dir The source directory or NULL for the current directory.
+ * @param filename The filename.
+ * @param cflags The additional compiler flags.
+ */
+void
+chaz_MakeBinary_add_src_file_with_flags(chaz_MakeBinary *self,
+                                        const char *dir,
+                                        const char *filename,
+                                        const char *cflags);
+
 /** Add all .c files in a directory as sources for the binary.
  *
  * @param path The path to the directory.
@@ -296,6 +407,99 @@ chaz_MakeBinary_add_filtered_src_dir(chaz_MakeBinary *self, const char *path,
                                      chaz_Make_file_filter_t filter,
                                      void *context);
 
+/** Compile the sources of the binary in unity batches. When the makefile
+ * is written, the sources are split into batches and, for every batch, a
+ * C file is generated that includes all the sources of the batch. Only
+ * these files are compiled.
+ *
+ * @param num_batches The number of batches. Pass 0 to compile every source
+ * file separately.
+ * @param filter A callback that is invoked for every source file. Only
+ * files for which the callback returns true are added to a batch. Other
+ * files are compiled separately. May be NULL.
+ * @param context Context passed to filter.
+ */
+void
+chaz_MakeBinary_set_unity_batches(chaz_MakeBinary *self, int num_batches,
+                                  chaz_Make_file_filter_t filter,
+                                  void *context);
+
+/** Precompile a header and use it for all the sources of the binary. The
+ * header is built with the compile flags of the binary and force-included
+ * in every source file. Only supported with GCC, Clang and MSVC. The
+ * precompiled header is placed in the build directory if there is one.
+ *
+ * @param header The path to the header.
+ * @return true if the header will be precompiled, false if the compiler
+ * isn't supported.
+ */
+int
+chaz_MakeBinary_add_pch(chaz_MakeBinary *self, const char *header);
+
+/** Enable link-time optimization for the binary. Compile and link flags
+ * are added and static libraries are built with an archiver that supports
+ * LTO objects. The link command is marked as recursive, so that GCC can
+ * use the jobserver of GNU make for the parallel LTO stage. Returns false
+ * if the toolchain doesn't support LTO.
+ *
+ * @param mode One of the CHAZ_CFLAGS_LTO constants.
+ */
+int
+chaz_MakeBinary_enable_lto(chaz_MakeBinary *self, int mode);
+
+/** Write DWARF debugging information to .dwo files next to the objects,
+ * which speeds up linking. The .dwo files are removed by 'make clean'.
+ * Debugging information must be enabled separately. Returns false if the
+ * toolchain doesn't support split debugging information.
+ */
+int
+chaz_MakeBinary_split_debug_info(chaz_MakeBinary *self);
+
+/** Compile every function and data item into its own section and make the
+ * linker remove unused sections. For static libraries, only the compile
+ * flags are added and sections are removed when linking the final binary.
+ * Returns false if the toolchain doesn't support this.
+ */
+int
+chaz_MakeBinary_enable_section_gc(chaz_MakeBinary *self);
+
+/** Link the binary with the fastest available linker. See
+ * chaz_CFlags_use_fast_linker. Returns false for static libraries or if
+ * no faster linker is available.
+ */
+int
+chaz_MakeBinary_use_fast_linker(chaz_MakeBinary *self);
+
+/** Reduce the dynamic loading cost of an executable or shared library on
+ * ELF platforms, see chaz_CFlags_optimize_dynamic_loading. Shared
+ * libraries and their object groups are also compiled with
+ * -fno-semantic-interposition. If a shared library and all its object
+ * groups hide their symbols, calls to its exported functions are bound
+ * locally with -Bsymbolic-functions. Returns false if unsupported.
+ */
+int
+chaz_MakeBinary_optimize_dynamic_loading(chaz_MakeBinary *self);
+
+/** Pass the objects to the archiver or linker in a response file with
+ * '@file' instead of on the command line. This avoids the command line
+ * limit of cmd.exe for long lists of objects. The response file is
+ * generated by Charmonizer, so `BUILDDIR` can't be overridden when running
+ * make. Returns false for object groups or if the toolchain isn't known to
+ * support response files.
+ */
+int
+chaz_MakeBinary_use_response_file(chaz_MakeBinary *self);
+
+/** Build a static library as thin archive which only references the
+ * objects instead of copying them. This is useful for intermediate
+ * libraries that are linked into a shared library or executable of the
+ * same build. Returns false if the binary isn't a static library, if the
+ * library is installed or if thin archives aren't supported. In this case,
+ * a normal archive is built.
+ */
+int
+chaz_MakeBinary_use_thin_archive(chaz_MakeBinary *self);
+
 /** Add a prerequisite to the make rule of the binary.
  *
  * @param prereq The prerequisite.
@@ -303,7 +507,18 @@ chaz_MakeBinary_add_filtered_src_dir(chaz_MakeBinary *self, const char *path,
 void
 chaz_MakeBinary_add_prereq(chaz_MakeBinary *self, const char *prereq);
 
-/** Return a list of all objects separated by space.
+/** Link the objects of an object group into the binary. The objects are
+ * compiled with the flags of the group, not those of the binary. If the
+ * binary is a shared library, the group is compiled as position-independent
+ * code. Such objects can still be archived in static libraries and linked
+ * into executables on all supported platforms.
+ */
+void
+chaz_MakeBinary_add_object_group(chaz_MakeBinary *self,
+                                 chaz_MakeBinary *group);
+
+/** Return a list of all objects separated by space, including the objects
+ * of object groups.
  */
 char*
 chaz_MakeBinary_obj_string(chaz_MakeBinary *self);
@@ -14,12 +14,31 @@
  * limitations under the License.
  */
 
+#ifndef _WIN32
+  /* Declare POSIX functions like lstat and kill in strict C modes. */
+  #ifndef _XOPEN_SOURCE
+    #define _XOPEN_SOURCE 500
+  #endif
+#endif
+
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
 #include <ctype.h>
 #include <time.h>
 #include <errno.h>
+#ifndef _WIN32
+  #include <sys/types.h>
+  #include <sys/stat.h>
+  #include <sys/time.h>
+  #include <sys/select.h>
+  #include <sys/resource.h>
+  #include <sys/wait.h>
+  #include <unistd.h>
+  #include <fcntl.h>
+  #include <signal.h>
+  #include <dirent.h>
+#endif
 
 #include "Charmonizer/Core/Compiler.h"
 #include "Charmonizer/Core/Util.h"
@@ -36,20 +55,84 @@ static struct {
     char local_command_start[3];
     int  shell_type;
     int  run_sh_via_cmd_exe;
-} chaz_OS = { "", "", "", "", 0, 0 };
+    long timeout;
+    long mem_limit;
+} chaz_OS = { "", "", "", "", 0, 0, 0, 0 };
 
 static int
 chaz_OS_run_sh_via_cmd_exe(const char *command, const char *path);
 
+#ifdef _WIN32
+/* Detect the shell used by system() by running a command.
+ */
+static void
+chaz_OS_detect_shell(void);
+#else
+#define CHAZ_OS_ENTRY_UNKNOWN  0
+#define CHAZ_OS_ENTRY_FILE     1
+#define CHAZ_OS_ENTRY_DIR      2
+
+typedef struct chaz_OSDirEntry {
+    char *name;
+    int   type;
+} chaz_OSDirEntry;
+
+/* Recursive helper for chaz_OS_list_files.
+ */
+static void
+chaz_OS_list_dir(const char *dir, const char *subdir, const char *ext,
+                 chaz_OS_file_callback_t callback, void *context);
+
+/* Comparison function to feed to qsort.
+ */
+static int
+chaz_OS_compare_entries(const void *va, const void *vb);
+
+/* Run a command in a child process with the configured resource limits
+ * and kill it if it exceeds the timeout.
+ */
+static int
+chaz_OS_run_limited(const char *command, const char *path);
+#endif
+
 void
 chaz_OS_init(void) {
-    char *output;
-    size_t output_len;
-
     if (chaz_Util_verbosity) {
         printf("Initializing Charmonizer/Core/OperatingSystem...\n");
     }
 
+#ifdef _WIN32
+    chaz_OS_detect_shell();
+#else
+    /* On non-Windows hosts, system() always runs /bin/sh, so there's no
+     * need to spawn a shell to find out. */
+    if (chaz_Util_verbosity) {
+        printf("Detected POSIX shell\n");
+    }
+    chaz_OS.shell_type = CHAZ_OS_POSIX;
+    strcpy(chaz_OS.dev_null, "/dev/null");
+#endif
+
+    if (chaz_OS.shell_type == CHAZ_OS_CMD_EXE) {
+        strcpy(chaz_OS.dir_sep, "\\");
+        /* Empty string should work, too. */
+        strcpy(chaz_OS.local_command_start, ".\\");
+    }
+    else if (chaz_OS.shell_type == CHAZ_OS_POSIX) {
+        strcpy(chaz_OS.dir_sep, "/");
+        strcpy(chaz_OS.local_command_start, "./");
+    }
+    else {
+        chaz_Util_die("Couldn't identify shell");
+    }
+}
+
+#ifdef _WIN32
+static void
+chaz_OS_detect_shell(void) {
+    char *output;
+    size_t output_len;
+
     /* Detect shell based on escape character. */
 
     /* Needed to make redirection work. */
@@ -96,20 +179,55 @@ chaz_OS_init(void) {
         strcpy(chaz_OS.dev_null, "/dev/null");
     }
 
-    if (chaz_OS.shell_type == CHAZ_OS_CMD_EXE) {
-        strcpy(chaz_OS.dir_sep, "\\");
-        /* Empty string should work, too. */
-        strcpy(chaz_OS.local_command_start, ".\\");
-    }
-    else if (chaz_OS.shell_type == CHAZ_OS_POSIX) {
-        strcpy(chaz_OS.dir_sep, "/");
-        strcpy(chaz_OS.local_command_start, "./");
-    }
-    else {
-        chaz_Util_die("Couldn't identify shell");
+    free(output);
+}
+#endif
+
+char*
+chaz_OS_find_executable(const char *name) {
+    const char *path = getenv("PATH");
+    const char *exe_ext = chaz_OS_exe_ext();
+#ifdef _WIN32
+    const char  path_sep = ';';
+#else
+    const char  path_sep = ':';
+#endif
+
+    if (path == NULL) { return NULL; }
+
+    while (1) {
+        const char *end = strchr(path, path_sep);
+        size_t      len = end ? (size_t)(end - path) : strlen(path);
+
+        if (len > 0) {
+            char *dir = (char*)malloc(len + 1);
+            char *candidate;
+            int   found;
+
+            memcpy(dir, path, len);
+            dir[len] = '\0';
+            candidate = chaz_Util_join("", dir, chaz_OS.dir_sep, name,
+                                       exe_ext, NULL);
+#ifdef _WIN32
+            found = chaz_Util_can_open_file(candidate);
+#else
+            {
+                struct stat st;
+                found = stat(candidate, &st) == 0
+                        && S_ISREG(st.st_mode)
+                        && access(candidate, X_OK) == 0;
+            }
+#endif
+            free(dir);
+            if (found) { return candidate; }
+            free(candidate);
+        }
+
+        if (end == NULL) { break; }
+        path = end + 1;
     }
 
-    free(output);
+    return NULL;
 }
 
 const char*
@@ -138,6 +256,7 @@ chaz_OS_exe_ext(void) {
 
 int
 chaz_OS_remove(const char *name) {
+#ifdef _WIN32
     /*
      * On Windows it can happen that another process, typically a
      * virus scanner, still has an open handle on the file. This can
@@ -189,17 +308,112 @@ chaz_OS_remove(const char *name) {
 
     free(temp_name);
     return retval;
+#else
+    if (unlink(name) == 0) { return 1; }
+    return 0;
+#endif
 }
 
 int
 chaz_OS_run_local_redirected(const char *command, const char *path) {
     char *local_command
         = chaz_Util_join("", chaz_OS.local_command_start, command, NULL);
+#ifdef _WIN32
     int retval = chaz_OS_run_redirected(local_command, path);
+#else
+    int retval = chaz_OS_run_limited(local_command, path);
+#endif
     free(local_command);
     return retval;
 }
 
+void
+chaz_OS_set_run_limits(long timeout, long mem_limit) {
+    chaz_OS.timeout   = timeout;
+    chaz_OS.mem_limit = mem_limit;
+}
+
+#ifndef _WIN32
+static int
+chaz_OS_run_limited(const char *command, const char *path) {
+    pid_t  pid;
+    int    status  = 0;
+    long   delay   = 1000;
+    time_t start;
+
+    /* Don't let the child inherit unflushed output. */
+    fflush(stdout);
+    fflush(stderr);
+
+    pid = fork();
+    if (pid < 0) {
+        return chaz_OS_run_redirected(command, path);
+    }
+    if (pid == 0) {
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (fd < 0) { _exit(127); }
+        dup2(fd, 1);
+        dup2(fd, 2);
+        close(fd);
+
+        /* Run in a new process group, so that a timeout kills the shell
+         * and everything it started. */
+        setpgid(0, 0);
+#ifdef RLIMIT_CPU
+        if (chaz_OS.timeout > 0) {
+            struct rlimit limit;
+            limit.rlim_cur = (rlim_t)chaz_OS.timeout;
+            limit.rlim_max = (rlim_t)chaz_OS.timeout + 1;
+            setrlimit(RLIMIT_CPU, &limit);
+        }
+#endif
+#ifdef RLIMIT_AS
+        if (chaz_OS.mem_limit > 0) {
+            struct rlimit limit;
+            limit.rlim_cur = (rlim_t)chaz_OS.mem_limit * 1024 * 1024;
+            limit.rlim_max = limit.rlim_cur;
+            setrlimit(RLIMIT_AS, &limit);
+        }
+#endif
+        execl("/bin/sh", "sh", "-c", command, (char*)NULL);
+        _exit(127);
+    }
+    setpgid(pid, pid);
+
+    /* Poll for the child with increasing delays. */
+    start = time(NULL);
+    for (;;) {
+        pid_t          result = waitpid(pid, &status, WNOHANG);
+        struct timeval tv;
+
+        if (result == pid) { break; }
+        if (result < 0) {
+            if (errno == EINTR) { continue; }
+            /* Like system(), return -1 if the status is unknown. */
+            return -1;
+        }
+
+        if (chaz_OS.timeout > 0 && time(NULL) - start > chaz_OS.timeout) {
+            kill(-pid, SIGKILL);
+            kill(pid, SIGKILL);
+            while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+            if (chaz_Util_verbosity) {
+                printf("Command '%s' timed out after %ld seconds\n",
+                       command, chaz_OS.timeout);
+            }
+            return CHAZ_OS_TIMED_OUT;
+        }
+
+        tv.tv_sec  = 0;
+        tv.tv_usec = delay;
+        select(0, NULL, NULL, NULL, &tv);
+        if (delay < 100000) { delay *= 2; }
+    }
+
+    return status;
+}
+#endif
+
 int
 chaz_OS_run_quietly(const char *command) {
     return chaz_OS_run_redirected(command, chaz_OS.dev_null);
@@ -315,6 +529,7 @@ chaz_OS_run_and_capture(const char *command, size_t *output_len) {
 
 void
 chaz_OS_mkdir(const char *filepath) {
+#ifdef _WIN32
     char *command = NULL;
     if (chaz_OS.shell_type == CHAZ_OS_POSIX
         || chaz_OS.shell_type == CHAZ_OS_CMD_EXE
@@ -326,10 +541,14 @@ chaz_OS_mkdir(const char *filepath) {
     }
     chaz_OS_run_quietly(command);
     free(command);
+#else
+    mkdir(filepath, 0777);
+#endif
 }
 
 void
 chaz_OS_rmdir(const char *filepath) {
+#ifdef _WIN32
     char *command = NULL;
     if (chaz_OS.shell_type == CHAZ_OS_POSIX) {
         command = chaz_Util_join(" ", "rmdir", filepath, NULL);
@@ -342,5 +561,113 @@ chaz_OS_rmdir(const char *filepath) {
     }
     chaz_OS_run_quietly(command);
     free(command);
+#else
+    rmdir(filepath);
+#endif
 }
 
+int
+chaz_OS_list_files(const char *dir, const char *ext,
+                   chaz_OS_file_callback_t callback, void *context) {
+#ifdef _WIN32
+    (void)dir;
+    (void)ext;
+    (void)callback;
+    (void)context;
+    return 0;
+#else
+    chaz_OS_list_dir(dir, "", ext, callback, context);
+    return 1;
+#endif
+}
+
+#ifndef _WIN32
+static void
+chaz_OS_list_dir(const char *dir, const char *subdir, const char *ext,
+                 chaz_OS_file_callback_t callback, void *context) {
+    char    *path;
+    DIR     *dirhandle;
+    struct dirent *entry;
+    chaz_OSDirEntry *entries = NULL;
+    size_t   num_entries = 0;
+    size_t   cap         = 0;
+    size_t   ext_len     = strlen(ext);
+    size_t   i;
+
+    path = subdir[0] == '\0'
+           ? chaz_Util_strdup(dir)
+           : chaz_Util_join("/", dir, subdir, NULL);
+    dirhandle = opendir(path);
+    if (dirhandle == NULL) {
+        chaz_Util_die("Failed to list files in '%s': %s", path,
+                      strerror(errno));
+    }
+    while (NULL != (entry = readdir(dirhandle))) {
+        const char *name = entry->d_name;
+        int type = CHAZ_OS_ENTRY_UNKNOWN;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) { continue; }
+#if defined(DT_DIR) && defined(DT_REG)
+        /* Avoid a stat call if the file type is reported by readdir. */
+        if (entry->d_type == DT_DIR)      { type = CHAZ_OS_ENTRY_DIR; }
+        else if (entry->d_type == DT_REG) { type = CHAZ_OS_ENTRY_FILE; }
+#endif
+        if (num_entries == cap) {
+            cap = cap ? cap * 2 : 16;
+            entries = (chaz_OSDirEntry*)realloc(entries,
+                                                cap * sizeof(chaz_OSDirEntry));
+        }
+        entries[num_entries].name = chaz_Util_strdup(name);
+        entries[num_entries].type = type;
+        num_entries++;
+    }
+    closedir(dirhandle);
+    qsort(entries, num_entries, sizeof(chaz_OSDirEntry),
+          chaz_OS_compare_entries);
+
+    for (i = 0; i < num_entries; i++) {
+        const char *name = entries[i].name;
+        size_t name_len = strlen(name);
+        int type = entries[i].type;
+        char *rel_path = subdir[0] == '\0'
+                         ? chaz_Util_strdup(name)
+                         : chaz_Util_join("/", subdir, name, NULL);
+
+        if (type == CHAZ_OS_ENTRY_UNKNOWN) {
+            /* Like 'find -type f', don't follow symlinks. This also
+             * avoids endless recursion into symlink cycles. */
+            char *full_path = chaz_Util_join("/", path, name, NULL);
+            struct stat st;
+            if (lstat(full_path, &st) == 0) {
+                if (S_ISDIR(st.st_mode))      { type = CHAZ_OS_ENTRY_DIR; }
+                else if (S_ISREG(st.st_mode)) { type = CHAZ_OS_ENTRY_FILE; }
+            }
+            free(full_path);
+        }
+
+        if (type == CHAZ_OS_ENTRY_DIR) {
+            chaz_OS_list_dir(dir, rel_path, ext, callback, context);
+        }
+        else if (type == CHAZ_OS_ENTRY_FILE
+                 && name_len > ext_len + 1
+                 && name[name_len-ext_len-1] == '.'
+                 && strcmp(name + name_len - ext_len, ext) == 0
+                ) {
+            callback(dir, rel_path, context);
+        }
+
+        free(rel_path);
+        free(entries[i].name);
+    }
+
+    free(entries);
+    free(path);
+}
+
+static int
+chaz_OS_compare_entries(const void *va, const void *vb) {
+    const chaz_OSDirEntry *a = (const chaz_OSDirEntry*)va;
+    const chaz_OSDirEntry *b = (const chaz_OSDirEntry*)vb;
+    return strcmp(a->name, b->name);
+}
+#endif
+
@@ -28,6 +28,14 @@ extern "C" {
 #define CHAZ_OS_POSIX    1
 #define CHAZ_OS_CMD_EXE  2
 
+/* Status returned by chaz_OS_run_local_redirected if the command was killed
+ * because it exceeded the timeout.
+ */
+#define CHAZ_OS_TIMED_OUT  -2
+
+typedef void
+(*chaz_OS_file_callback_t)(const char *dir, char *file, void *context);
+
 /* Safely remove a file named [name]. Needed because of Windows quirks.
  * Returns true on success, false on failure.
  */
@@ -48,11 +56,23 @@ chaz_OS_run_redirected(const char *command, const char *path);
 
 /* Run a command beginning with the name of an executable in the current
  * working directory and capture both stdout and stderr to the supplied
- * filepath.
+ * filepath. On POSIX systems, the limits set with chaz_OS_set_run_limits
+ * are enforced and CHAZ_OS_TIMED_OUT is returned if the command had to be
+ * killed. Returns -1 if the exit status couldn't be determined.
  */
 int
 chaz_OS_run_local_redirected(const char *command, const char *path);
 
+/* Set limits for commands run with chaz_OS_run_local_redirected.
+ *
+ * @param timeout Wall-clock timeout in seconds. Also used as CPU time limit.
+ * 0 means no limit.
+ * @param mem_limit Limit of the address space in megabytes. 0 means no
+ * limit.
+ */
+void
+chaz_OS_set_run_limits(long timeout, long mem_limit);
+
 /* Run a command and return the output from stdout.
  */
 char*
@@ -68,6 +88,22 @@ chaz_OS_mkdir(const char *filepath);
 void
 chaz_OS_rmdir(const char *filepath);
 
+/* Recursively list regular files with extension [ext] in directory [dir]
+ * without spawning a process. The callback is invoked in sorted order with
+ * the path of every file relative to [dir]. Return false if there's no
+ * native implementation on this system.
+ */
+int
+chaz_OS_list_files(const char *dir, const char *ext,
+                   chaz_OS_file_callback_t callback, void *context);
+
+/* Search the directories in the PATH environment variable for an
+ * executable. Return the full path of the executable in a newly allocated
+ * string or NULL if it wasn't found.
+ */
+char*
+chaz_OS_find_executable(const char *name);
+
 /* Return the equivalent of /dev/null on this system.
  */
 const char*
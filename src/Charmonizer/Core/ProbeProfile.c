@@ -0,0 +1,635 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Charmonizer/Core/ProbeProfile.h"
+#include "Charmonizer/Core/CFlags.h"
+#include "Charmonizer/Core/Compiler.h"
+#include "Charmonizer/Core/Util.h"
+
+#define CHAZ_PROBEPROFILE_HEADER  "chaz-probe-profile 1"
+
+/* Number of randomly chosen results to verify in addition to the results
+ * of probe runs.
+ */
+#define CHAZ_PROBEPROFILE_SAMPLE_SIZE  8
+
+typedef struct chaz_ProbeResult {
+    int            kind;
+    unsigned long  hash;
+    char          *flags;
+    char          *source;
+    int            result;
+    char          *output;
+    size_t         output_len;
+} chaz_ProbeResult;
+
+static struct {
+    char              *path;
+    char              *fingerprint;
+    char              *other_profiles;
+    chaz_ProbeResult  *results;
+    size_t             num_results;
+    size_t             cap;
+    int                active;
+    int                dirty;
+    chaz_ProbeResult  *verifying;
+    int                mismatch;
+} chaz_ProbeProfile = {
+    NULL, NULL, NULL,
+    NULL, 0, 0,
+    0, 0,
+    NULL, 0
+};
+
+/* Compile and run a program printing predefined macros that identify the
+ * toolchain and target, and return a fingerprint string.
+ */
+static char*
+chaz_ProbeProfile_fingerprint(void);
+
+/* Parse the profile file and load the results for our fingerprint.
+ */
+static void
+chaz_ProbeProfile_load(const char *content);
+
+/* Rerun a sample of the loaded results. Return true if all match.
+ */
+static int
+chaz_ProbeProfile_verify(void);
+
+/* Return the extra and temporary compiler flags currently in effect.
+ */
+static char*
+chaz_ProbeProfile_current_flags(void);
+
+/* Return the temporary flags of recorded [flags] by skipping the current
+ * extra compiler flags. Return NULL if the flags were recorded with other
+ * extra flags.
+ */
+static const char*
+chaz_ProbeProfile_temp_flags(const char *flags);
+
+static void
+chaz_ProbeProfile_add(int kind, const char *flags, const char *source,
+                      int result, const char *output, size_t output_len);
+
+static void
+chaz_ProbeProfile_free_results(void);
+
+static unsigned long
+chaz_ProbeProfile_hash(int kind, const char *flags, const char *source);
+
+/* Escape a string so that it doesn't contain whitespace.
+ */
+static char*
+chaz_ProbeProfile_escape(const char *string, size_t len);
+
+/* Unescape a string in place. Return the length of the unescaped string.
+ */
+static size_t
+chaz_ProbeProfile_unescape(char *string);
+
+void
+chaz_ProbeProfile_init(const char *path) {
+    char   *content;
+    size_t  content_len;
+
+    /* Compute the fingerprint before activating the profile so that the
+     * fingerprint program itself is never replayed. */
+    chaz_ProbeProfile.path        = chaz_Util_strdup(path);
+    chaz_ProbeProfile.fingerprint = chaz_ProbeProfile_fingerprint();
+    chaz_ProbeProfile.active      = 1;
+
+    if (!chaz_Util_can_open_file(path)) {
+        if (chaz_Util_verbosity) {
+            printf("Recording probe profile '%s'\n", path);
+        }
+        chaz_ProbeProfile.dirty = 1;
+        return;
+    }
+
+    content = chaz_Util_slurp_file(path, &content_len);
+    if (content != NULL) {
+        chaz_ProbeProfile_load(content);
+        free(content);
+    }
+
+    if (chaz_ProbeProfile.num_results == 0) {
+        if (chaz_Util_verbosity) {
+            printf("No matching probe profile found in '%s'\n", path);
+        }
+        chaz_ProbeProfile.dirty = 1;
+    }
+    else if (!chaz_ProbeProfile_verify()) {
+        if (chaz_Util_verbosity) {
+            printf("Probe profile doesn't match, probing everything\n");
+        }
+        chaz_ProbeProfile_free_results();
+        chaz_ProbeProfile.dirty = 1;
+    }
+    else if (chaz_Util_verbosity) {
+        printf("Using probe profile from '%s'\n", path);
+    }
+}
+
+void
+chaz_ProbeProfile_clean_up(void) {
+    if (!chaz_ProbeProfile.active) { return; }
+
+    if (chaz_ProbeProfile.dirty) {
+        FILE   *file = fopen(chaz_ProbeProfile.path, "w");
+        char   *escaped;
+        size_t  i;
+
+        if (file == NULL) {
+            chaz_Util_die("Can't open '%s'", chaz_ProbeProfile.path);
+        }
+        fprintf(file, "%s\n", CHAZ_PROBEPROFILE_HEADER);
+        if (chaz_ProbeProfile.other_profiles) {
+            fputs(chaz_ProbeProfile.other_profiles, file);
+        }
+        escaped = chaz_ProbeProfile_escape(
+                      chaz_ProbeProfile.fingerprint,
+                      strlen(chaz_ProbeProfile.fingerprint));
+        fprintf(file, "fingerprint =%s\n", escaped);
+        free(escaped);
+        for (i = 0; i < chaz_ProbeProfile.num_results; i++) {
+            chaz_ProbeResult *entry = &chaz_ProbeProfile.results[i];
+            char *flags  = chaz_ProbeProfile_escape(entry->flags,
+                                                    strlen(entry->flags));
+            char *source = chaz_ProbeProfile_escape(entry->source,
+                                                    strlen(entry->source));
+            char *output = chaz_ProbeProfile_escape(entry->output,
+                                                    entry->output_len);
+            fprintf(file, "result %d %d =%s =%s =%s\n", entry->kind,
+                    entry->result, flags, source, output);
+            free(flags);
+            free(source);
+            free(output);
+        }
+        fprintf(file, "end\n");
+        if (fclose(file)) {
+            chaz_Util_die("Error closing '%s'", chaz_ProbeProfile.path);
+        }
+    }
+
+    chaz_ProbeProfile_free_results();
+    free(chaz_ProbeProfile.path);
+    free(chaz_ProbeProfile.fingerprint);
+    free(chaz_ProbeProfile.other_profiles);
+    chaz_ProbeProfile.path           = NULL;
+    chaz_ProbeProfile.fingerprint    = NULL;
+    chaz_ProbeProfile.other_profiles = NULL;
+    chaz_ProbeProfile.active         = 0;
+}
+
+int
+chaz_ProbeProfile_lookup(int kind, const char *source, int *result,
+                         char **output, size_t *output_len) {
+    unsigned long hash;
+    char *flags;
+    size_t i;
+    int found = 0;
+
+    if (!chaz_ProbeProfile.active || chaz_ProbeProfile.verifying) {
+        return 0;
+    }
+
+    flags = chaz_ProbeProfile_current_flags();
+    hash  = chaz_ProbeProfile_hash(kind, flags, source);
+    for (i = 0; i < chaz_ProbeProfile.num_results; i++) {
+        chaz_ProbeResult *entry = &chaz_ProbeProfile.results[i];
+        if (entry->hash == hash
+            && entry->kind == kind
+            && strcmp(entry->flags, flags) == 0
+            && strcmp(entry->source, source) == 0
+           ) {
+            *result = entry->result;
+            if (output) {
+                *output_len = entry->output_len;
+                if (entry->output_len == 0) {
+                    *output = NULL;
+                }
+                else {
+                    *output = (char*)malloc(entry->output_len + 1);
+                    memcpy(*output, entry->output, entry->output_len + 1);
+                }
+            }
+            found = 1;
+            break;
+        }
+    }
+
+    free(flags);
+    return found;
+}
+
+void
+chaz_ProbeProfile_record(int kind, const char *source, int result,
+                         const char *output, size_t output_len) {
+    chaz_ProbeResult *verifying = chaz_ProbeProfile.verifying;
+    char *flags;
+
+    if (!chaz_ProbeProfile.active) { return; }
+
+    if (verifying) {
+        /* Object files may contain timestamps, so only compare the
+         * result. */
+        if (verifying->result != result
+            || (kind == CHAZ_PROBEPROFILE_RUN
+                && (verifying->output_len != output_len
+                    || (output_len > 0
+                        && memcmp(verifying->output, output,
+                                  output_len) != 0)))
+           ) {
+            chaz_ProbeProfile.mismatch = 1;
+        }
+        return;
+    }
+
+    flags = chaz_ProbeProfile_current_flags();
+    chaz_ProbeProfile_add(kind, flags, source, result, output, output_len);
+    chaz_ProbeProfile.dirty = 1;
+    free(flags);
+}
+
+static char*
+chaz_ProbeProfile_fingerprint(void) {
+    static const char fingerprint_code[] =
+        CHAZ_QUOTE(  #include <stdio.h>                                   )
+        CHAZ_QUOTE(  #include <limits.h>                                  )
+        CHAZ_QUOTE(  #define CHAZ_M(m) printf("%s;", #m)                   )
+        CHAZ_QUOTE(  int main() {                                         )
+        CHAZ_QUOTE(  #ifdef __VERSION__                                   )
+        CHAZ_QUOTE(      printf("version=%s;", __VERSION__);              )
+        CHAZ_QUOTE(  #endif                                               )
+        CHAZ_QUOTE(  #ifdef _MSC_FULL_VER                                 )
+        CHAZ_QUOTE(      printf("msvc=%ld;", (long)_MSC_FULL_VER);        )
+        CHAZ_QUOTE(  #endif                                               )
+        CHAZ_QUOTE(  #ifdef __SUNPRO_C                                    )
+        CHAZ_QUOTE(      printf("sunc=%ld;", (long)__SUNPRO_C);           )
+        CHAZ_QUOTE(  #endif                                               )
+        CHAZ_QUOTE(  #ifdef __GLIBC__                                     )
+        CHAZ_QUOTE(      printf("glibc=%d.%d;", __GLIBC__, __GLIBC_MINOR__); )
+        CHAZ_QUOTE(  #endif                                               )
+        CHAZ_QUOTE(  #ifdef __x86_64__                                    )
+        CHAZ_QUOTE(      CHAZ_M(__x86_64__);                              )
+        CHAZ_QUOTE(  #endif                                               )
+        CHAZ_QUOTE(  #ifdef __i386__                                      )
+        CHAZ_QUOTE(      CHAZ_M(__i386__);                                )
+        CHAZ_QUOTE(  #endif                                               )
+        CHAZ_QUOTE(  #ifdef __aarch64__                                   )
+        CHAZ_QUOTE(      CHAZ_M(__aarch64__);                             )
+        CHAZ_QUOTE(  #endif                                               )
+        CHAZ_QUOTE(  #ifdef __arm__                                       )
+        CHAZ_QUOTE(      CHAZ_M(__arm__);                                 )
+        CHAZ_QUOTE(  #endif                                               )
+        CHAZ_QUOTE(  #ifdef __powerpc64__                                 )
+        CHAZ_QUOTE(      CHAZ_M(__powerpc64__);                           )
+        CHAZ_QUOTE(  #endif                                               )
+        CHAZ_QUOTE(  #ifdef _M_X64                                        )
+        CHAZ_QUOTE(      CHAZ_M(_M_X64);                                  )
+        CHAZ_QUOTE(  #endif                                               )
+        CHAZ_QUOTE(  #ifdef _M_ARM64                                      )
+        CHAZ_QUOTE(      CHAZ_M(_M_ARM64);                                )
+        CHAZ_QUOTE(  #endif                                               )
+        CHAZ_QUOTE(  #ifdef __linux__                                     )
+        CHAZ_QUOTE(      CHAZ_M(__linux__);                               )
+        CHAZ_QUOTE(  #endif                                               )
+        CHAZ_QUOTE(  #ifdef __APPLE__                                     )
+        CHAZ_QUOTE(      CHAZ_M(__APPLE__);                               )
+        CHAZ_QUOTE(  #endif                                               )
+        CHAZ_QUOTE(  #ifdef __FreeBSD__                                   )
+        CHAZ_QUOTE(      CHAZ_M(__FreeBSD__);                             )
+        CHAZ_QUOTE(  #endif                                               )
+        CHAZ_QUOTE(  #ifdef _WIN32                                        )
+        CHAZ_QUOTE(      CHAZ_M(_WIN32);                                  )
+        CHAZ_QUOTE(  #endif                                               )
+        CHAZ_QUOTE(  #ifdef __CYGWIN__                                    )
+        CHAZ_QUOTE(      CHAZ_M(__CYGWIN__);                              )
+        CHAZ_QUOTE(  #endif                                               )
+        CHAZ_QUOTE(      printf("int=%d;", (int)sizeof(int));             )
+        CHAZ_QUOTE(      printf("long=%d;", (int)sizeof(long));           )
+        CHAZ_QUOTE(      printf("ptr=%d;", (int)sizeof(void*));           )
+        CHAZ_QUOTE(      return 0;                                        )
+        CHAZ_QUOTE(  }                                                    );
+    char   *output;
+    size_t  output_len;
+    char   *fingerprint;
+
+    output = chaz_CC_capture_output(fingerprint_code, &output_len);
+    if (output == NULL) {
+        chaz_Util_die("Failed to compute compiler fingerprint");
+    }
+    fingerprint = chaz_Util_join(" ", chaz_CC_get_cc(), chaz_CC_get_cflags(),
+                                 output, NULL);
+    free(output);
+    return fingerprint;
+}
+
+static void
+chaz_ProbeProfile_load(const char *content) {
+    const char *line = content;
+    const char *section_start = NULL;
+    char   *other_profiles = chaz_Util_strdup("");
+    size_t  other_len = 0;
+    int     in_ours = 0;
+    int     first = 1;
+
+    while (*line != '\0') {
+        const char *end = strchr(line, '\n');
+        size_t      line_len = end ? (size_t)(end - line) : strlen(line);
+        char       *buf = (char*)malloc(line_len + 1);
+
+        memcpy(buf, line, line_len);
+        buf[line_len] = '\0';
+
+        if (first) {
+            first = 0;
+            if (strcmp(buf, CHAZ_PROBEPROFILE_HEADER) != 0) {
+                chaz_Util_warn("Invalid probe profile '%s'",
+                               chaz_ProbeProfile.path);
+                free(buf);
+                break;
+            }
+        }
+        else if (strncmp(buf, "fingerprint =", 13) == 0) {
+            chaz_ProbeProfile_unescape(buf + 13);
+            in_ours = strcmp(buf + 13, chaz_ProbeProfile.fingerprint) == 0;
+            section_start = in_ours ? NULL : line;
+        }
+        else if (strcmp(buf, "end") == 0) {
+            if (section_start) {
+                /* Keep profiles for other fingerprints verbatim. */
+                size_t len = (size_t)(line + line_len - section_start);
+                other_profiles = (char*)realloc(other_profiles,
+                                                other_len + len + 2);
+                memcpy(other_profiles + other_len, section_start, len);
+                other_len += len;
+                other_profiles[other_len++] = '\n';
+                other_profiles[other_len]   = '\0';
+            }
+            in_ours = 0;
+            section_start = NULL;
+        }
+        else if (in_ours && strncmp(buf, "result ", 7) == 0) {
+            int     kind, result;
+            char   *flags, *source, *output;
+            size_t  output_len;
+
+            flags  = strstr(buf, " =");
+            source = flags  ? strstr(flags + 2, " =")  : NULL;
+            output = source ? strstr(source + 2, " =") : NULL;
+            if (output == NULL
+                || sscanf(buf + 7, "%d %d", &kind, &result) != 2
+               ) {
+                chaz_Util_die("Invalid line in probe profile: '%s'", buf);
+            }
+            *flags = *source = *output = '\0';
+            flags  += 2;
+            source += 2;
+            output += 2;
+            chaz_ProbeProfile_unescape(flags);
+            chaz_ProbeProfile_unescape(source);
+            output_len = chaz_ProbeProfile_unescape(output);
+            chaz_ProbeProfile_add(kind, flags, source, result, output,
+                                  output_len);
+        }
+
+        free(buf);
+        if (end == NULL) { break; }
+        line = end + 1;
+    }
+
+    free(chaz_ProbeProfile.other_profiles);
+    chaz_ProbeProfile.other_profiles = other_profiles;
+}
+
+static int
+chaz_ProbeProfile_verify(void) {
+    size_t   num_results = chaz_ProbeProfile.num_results;
+    char    *selected    = (char*)calloc(num_results, 1);
+    size_t   i;
+    int      num_random  = CHAZ_PROBEPROFILE_SAMPLE_SIZE;
+    int      num_checked = 0;
+    unsigned long seed   = 0;
+
+    /* Always verify the output of probe runs. These depend on the
+     * runtime environment and are few. */
+    for (i = 0; i < num_results; i++) {
+        if (chaz_ProbeProfile.results[i].kind == CHAZ_PROBEPROFILE_RUN) {
+            selected[i] = 1;
+        }
+    }
+
+    /* Add a pseudo-random sample of the other results. The generator is
+     * seeded from the profile, so that configuring the same tree twice
+     * verifies the same probes. */
+    for (i = 0; i < num_results; i++) {
+        seed = (seed * 31UL + chaz_ProbeProfile.results[i].hash)
+               & 0xFFFFFFFFUL;
+    }
+    for (i = 0; i < (size_t)num_random * 4 && num_random > 0; i++) {
+        size_t tick;
+        seed = (seed * 1103515245UL + 12345UL) & 0xFFFFFFFFUL;
+        tick = (size_t)(seed >> 16) % num_results;
+        if (!selected[tick]) {
+            selected[tick] = 1;
+            num_random--;
+        }
+    }
+
+    for (i = 0; i < num_results && !chaz_ProbeProfile.mismatch; i++) {
+        chaz_ProbeResult *entry = &chaz_ProbeProfile.results[i];
+        chaz_CFlags *temp_cflags = chaz_CC_get_temp_cflags();
+        const char  *temp_flags;
+        char   *output;
+        size_t  output_len;
+
+        if (!selected[i]) { continue; }
+        /* Results recorded with other extra flags are never looked up. */
+        temp_flags = chaz_ProbeProfile_temp_flags(entry->flags);
+        if (temp_flags == NULL) { continue; }
+
+        chaz_ProbeProfile.verifying = entry;
+        chaz_CFlags_append(temp_cflags, temp_flags);
+        switch (entry->kind) {
+            case CHAZ_PROBEPROFILE_COMPILE:
+                chaz_CC_test_compile(entry->source);
+                break;
+            case CHAZ_PROBEPROFILE_LINK:
+                chaz_CC_test_link(entry->source);
+                break;
+            case CHAZ_PROBEPROFILE_RUN:
+                output = chaz_CC_capture_output(entry->source, &output_len);
+                free(output);
+                break;
+            case CHAZ_PROBEPROFILE_OBJ:
+                output = chaz_CC_capture_obj(entry->source, &output_len);
+                free(output);
+                break;
+            default:
+                chaz_ProbeProfile.mismatch = 1;
+                break;
+        }
+        chaz_CFlags_clear(temp_cflags);
+        chaz_ProbeProfile.verifying = NULL;
+        num_checked++;
+    }
+
+    if (chaz_Util_verbosity) {
+        printf("Verified %d of %lu profiled probes\n", num_checked,
+               (unsigned long)num_results);
+    }
+
+    free(selected);
+    return !chaz_ProbeProfile.mismatch;
+}
+
+static char*
+chaz_ProbeProfile_current_flags(void) {
+    chaz_CFlags *extra_cflags = chaz_CC_get_extra_cflags();
+    chaz_CFlags *temp_cflags  = chaz_CC_get_temp_cflags();
+    const char  *extra = extra_cflags ? chaz_CFlags_get_string(extra_cflags)
+                                      : "";
+    const char  *temp  = temp_cflags ? chaz_CFlags_get_string(temp_cflags)
+                                     : "";
+
+    if (extra[0] == '\0') { return chaz_Util_strdup(temp); }
+    if (temp[0] == '\0')  { return chaz_Util_strdup(extra); }
+    return chaz_Util_join(" ", extra, temp, NULL);
+}
+
+static const char*
+chaz_ProbeProfile_temp_flags(const char *flags) {
+    chaz_CFlags *extra_cflags = chaz_CC_get_extra_cflags();
+    const char  *extra = extra_cflags ? chaz_CFlags_get_string(extra_cflags)
+                                      : "";
+    size_t       extra_len = strlen(extra);
+
+    if (extra_len == 0) { return flags; }
+    if (strncmp(flags, extra, extra_len) != 0) { return NULL; }
+    if (flags[extra_len] == '\0') { return flags + extra_len; }
+    if (flags[extra_len] != ' ') { return NULL; }
+    return flags + extra_len + 1;
+}
+
+static void
+chaz_ProbeProfile_add(int kind, const char *flags, const char *source,
+                      int result, const char *output, size_t output_len) {
+    chaz_ProbeResult *entry;
+
+    if (chaz_ProbeProfile.num_results == chaz_ProbeProfile.cap) {
+        size_t cap = chaz_ProbeProfile.cap ? chaz_ProbeProfile.cap * 2 : 64;
+        chaz_ProbeProfile.results
+            = (chaz_ProbeResult*)realloc(chaz_ProbeProfile.results,
+                                         cap * sizeof(chaz_ProbeResult));
+        chaz_ProbeProfile.cap = cap;
+    }
+
+    entry = &chaz_ProbeProfile.results[chaz_ProbeProfile.num_results++];
+    entry->kind       = kind;
+    entry->hash       = chaz_ProbeProfile_hash(kind, flags, source);
+    entry->flags      = chaz_Util_strdup(flags);
+    entry->source     = chaz_Util_strdup(source);
+    entry->result     = result;
+    entry->output     = (char*)malloc(output_len + 1);
+    entry->output_len = output_len;
+    if (output_len > 0) {
+        memcpy(entry->output, output, output_len);
+    }
+    entry->output[output_len] = '\0';
+}
+
+static void
+chaz_ProbeProfile_free_results(void) {
+    size_t i;
+
+    for (i = 0; i < chaz_ProbeProfile.num_results; i++) {
+        chaz_ProbeResult *entry = &chaz_ProbeProfile.results[i];
+        free(entry->flags);
+        free(entry->source);
+        free(entry->output);
+    }
+    free(chaz_ProbeProfile.results);
+    chaz_ProbeProfile.results     = NULL;
+    chaz_ProbeProfile.num_results = 0;
+    chaz_ProbeProfile.cap         = 0;
+}
+
+static unsigned long
+chaz_ProbeProfile_hash(int kind, const char *flags, const char *source) {
+    unsigned long hash = 5381 + (unsigned long)kind;
+    const char *p;
+
+    for (p = flags; *p; p++) {
+        hash = (hash * 33) ^ (unsigned char)*p;
+    }
+    for (p = source; *p; p++) {
+        hash = (hash * 33) ^ (unsigned char)*p;
+    }
+    return hash & 0xFFFFFFFFUL;
+}
+
+static char*
+chaz_ProbeProfile_escape(const char *string, size_t len) {
+    static const char hex[] = "0123456789ABCDEF";
+    char   *escaped = (char*)malloc(len * 3 + 1);
+    char   *p       = escaped;
+    size_t  i;
+
+    for (i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)string[i];
+        if (c > ' ' && c < 127 && c != '%' && c != '=') {
+            *p++ = (char)c;
+        }
+        else {
+            *p++ = '%';
+            *p++ = hex[c >> 4];
+            *p++ = hex[c & 0xF];
+        }
+    }
+    *p = '\0';
+
+    return escaped;
+}
+
+static size_t
+chaz_ProbeProfile_unescape(char *string) {
+    char *in  = string;
+    char *out = string;
+
+    while (*in) {
+        if (in[0] == '%' && in[1] != '\0' && in[2] != '\0') {
+            char hex[3];
+            hex[0] = in[1];
+            hex[1] = in[2];
+            hex[2] = '\0';
+            *out++ = (char)strtol(hex, NULL, 16);
+            in += 3;
+        }
+        else {
+            *out++ = *in++;
+        }
+    }
+    *out = '\0';
+
+    return (size_t)(out - string);
+}
+
@@ -0,0 +1,82 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Charmonizer/Core/ProbeProfile.h -- replay probe results from a profile.
+ */
+
+#ifndef H_CHAZ_PROBE_PROFILE
+#define H_CHAZ_PROBE_PROFILE 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+/* A probe profile is a file mapping compiler fingerprints to the results of
+ * all test compiles, links and probe runs made with that compiler. The
+ * fingerprint consists of the compiler command, the compiler flags and the
+ * output of a program that prints predefined macros for compiler version,
+ * architecture, OS and C library.
+ *
+ * If the file contains a profile for the current fingerprint, a sample of
+ * the recorded results is verified with real compiles and, if they match,
+ * all other results are taken from the profile. Otherwise, results are
+ * recorded and the profile is added to the file on clean up. A single file
+ * can hold profiles for several toolchains, so it can be shipped with a
+ * project.
+ */
+
+#define CHAZ_PROBEPROFILE_COMPILE  1
+#define CHAZ_PROBEPROFILE_LINK     2
+#define CHAZ_PROBEPROFILE_RUN      3
+#define CHAZ_PROBEPROFILE_OBJ      4
+
+/* Load the profile for the current compiler from [path] and verify it.
+ * Must be called after chaz_CC_init.
+ */
+void
+chaz_ProbeProfile_init(const char *path);
+
+/* Write the profile file if new results were recorded and free all
+ * resources.
+ */
+void
+chaz_ProbeProfile_clean_up(void);
+
+/* Look up the result of a probe. Return true if the result was found. In
+ * this case, [result] is set and, for probes with output, [output] is set
+ * to a newly allocated copy of the output (NULL if empty).
+ *
+ * @param kind The kind of probe, one of the CHAZ_PROBEPROFILE constants.
+ * @param source The source code of the probe.
+ */
+int
+chaz_ProbeProfile_lookup(int kind, const char *source, int *result,
+                         char **output, size_t *output_len);
+
+/* Record the result of a probe that was actually run.
+ */
+void
+chaz_ProbeProfile_record(int kind, const char *source, int result,
+                         const char *output, size_t output_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* H_CHAZ_PROBE_PROFILE */
+
@@ -45,6 +45,71 @@ chaz_Util_write_file(const char *filename, const char *content) {
     }
 }
 
+void
+chaz_Util_update_file(const char *filename, const char *content) {
+    FILE *fh = chaz_Util_open_updated_file(filename);
+    fwrite(content, sizeof(char), strlen(content), fh);
+    chaz_Util_close_updated_file(fh, filename);
+}
+
+FILE*
+chaz_Util_open_updated_file(const char *filename) {
+    char *tmp_name = chaz_Util_join("", filename, ".tmp", NULL);
+    FILE *fh       = fopen(tmp_name, "w+");
+    if (fh == NULL) {
+        chaz_Util_die("Couldn't open '%s': %s", tmp_name, strerror(errno));
+    }
+    free(tmp_name);
+    return fh;
+}
+
+void
+chaz_Util_close_updated_file(FILE *fh, const char *filename) {
+    char *tmp_name = chaz_Util_join("", filename, ".tmp", NULL);
+    int   changed  = 1;
+
+    if (fclose(fh)) {
+        chaz_Util_die("Error when closing '%s': %s", tmp_name,
+                      strerror(errno));
+    }
+
+    if (chaz_Util_can_open_file(filename)) {
+        size_t  old_len;
+        size_t  new_len;
+        char   *old_content = chaz_Util_slurp_file(filename, &old_len);
+        char   *new_content = chaz_Util_slurp_file(tmp_name, &new_len);
+        changed = old_len != new_len
+                  || (old_len != 0
+                      && memcmp(old_content, new_content, old_len) != 0);
+        free(old_content);
+        free(new_content);
+    }
+
+    if (!changed) {
+        if (chaz_Util_verbosity >= 2) {
+            printf("'%s' is unchanged\n", filename);
+        }
+        chaz_Util_remove_and_verify(tmp_name);
+    }
+    else if (rename(tmp_name, filename) != 0) {
+        int renamed = 0;
+#ifdef _WIN32
+        /* Windows doesn't replace existing files when renaming. */
+        if (chaz_Util_can_open_file(filename)) {
+            chaz_Util_remove_and_verify(filename);
+            renamed = rename(tmp_name, filename) == 0;
+        }
+#endif
+        /* Other errors like EXDEV or EACCES keep the old file. */
+        if (!renamed) {
+            chaz_Util_die("Couldn't rename '%s' to '%s': %s", tmp_name,
+                          filename, strerror(errno));
+        }
+    }
+
+    free(tmp_name);
+}
+
 char*
 chaz_Util_slurp_file(const char *file_path, size_t *len_ptr) {
     FILE   *const file = fopen(file_path, "rb");
@@ -230,4 +295,43 @@ chaz_Util_can_open_file(const char *file_path) {
     }
 }
 
+void
+chaz_Buf_init(chaz_Buf *self) {
+    self->ptr = NULL;
+    self->len = 0;
+    self->cap = 0;
+}
+
+void
+chaz_Buf_append(chaz_Buf *self, const char *string) {
+    chaz_Buf_append_len(self, string, strlen(string));
+}
 
+void
+chaz_Buf_append_len(chaz_Buf *self, const char *string, size_t len) {
+    if (self->len + len + 1 > self->cap) {
+        size_t cap = self->cap ? self->cap * 2 : 64;
+        while (cap < self->len + len + 1) { cap *= 2; }
+        self->ptr = (char*)realloc(self->ptr, cap);
+        if (self->ptr == NULL) {
+            chaz_Util_die("Out of memory");
+        }
+        self->cap = cap;
+    }
+    memcpy(self->ptr + self->len, string, len);
+    self->len += len;
+    self->ptr[self->len] = '\0';
+}
+
+void
+chaz_Buf_clear(chaz_Buf *self) {
+    free(self->ptr);
+    chaz_Buf_init(self);
+}
+
+char*
+chaz_Buf_yield(chaz_Buf *self) {
+    char *retval = self->ptr ? self->ptr : chaz_Util_strdup("");
+    chaz_Buf_init(self);
+    return retval;
+}
@@ -36,6 +36,26 @@ extern int chaz_Util_verbosity;
 void
 chaz_Util_write_file(const char *filename, const char *content);
 
+/* Write [content] to a file, but leave the file untouched if it already
+ * has the same content. This preserves the modification time of generated
+ * files, so that make doesn't rebuild everything depending on them.
+ */
+void
+chaz_Util_update_file(const char *filename, const char *content);
+
+/* Open a temporary file to write the new content of [filename]. The file
+ * must be closed with chaz_Util_close_updated_file.
+ */
+FILE*
+chaz_Util_open_updated_file(const char *filename);
+
+/* Close a file opened with chaz_Util_open_updated_file. If the content
+ * differs from [filename], the temporary file is renamed to [filename].
+ * Otherwise, it's removed.
+ */
+void
+chaz_Util_close_updated_file(FILE *fh, const char *filename);
+
 /* Read an entire file into memory.
  */
 char*
@@ -83,6 +103,42 @@ chaz_Util_remove_and_verify(const char *file_path);
 int
 chaz_Util_can_open_file(const char *file_path);
 
+/* A growable string. The capacity is doubled when it is exhausted, so
+ * building a string from many pieces takes linear time. [ptr] is NULL until
+ * something is appended and NUL-terminated afterwards.
+ */
+typedef struct chaz_Buf {
+    char   *ptr;
+    size_t  len;
+    size_t  cap;
+} chaz_Buf;
+
+/* Initialize an empty buffer.
+ */
+void
+chaz_Buf_init(chaz_Buf *self);
+
+/* Append a NUL-terminated string.
+ */
+void
+chaz_Buf_append(chaz_Buf *self, const char *string);
+
+/* Append [len] bytes of [string].
+ */
+void
+chaz_Buf_append_len(chaz_Buf *self, const char *string, size_t len);
+
+/* Free the memory of a buffer and make it empty.
+ */
+void
+chaz_Buf_clear(chaz_Buf *self);
+
+/* Return the content of the buffer and make it empty. The caller is
+ * responsible for freeing the returned string. Never returns NULL.
+ */
+char*
+chaz_Buf_yield(chaz_Buf *self);
+
 #ifdef __cplusplus
 }
 #endif
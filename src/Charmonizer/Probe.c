@@ -30,6 +30,10 @@
 #include "Charmonizer/Core/Compiler.h"
 #include "Charmonizer/Core/Make.h"
 #include "Charmonizer/Core/OperatingSystem.h"
+#include "Charmonizer/Core/ProbeProfile.h"
+
+/* Default timeout for probe programs in seconds. */
+#define CHAZ_PROBE_DEFAULT_TIMEOUT 60
 
 int
 chaz_Probe_parse_cli_args(int argc, const char *argv[], chaz_CLI *cli) {
@@ -37,20 +41,30 @@ chaz_Probe_parse_cli_args(int argc, const char *argv[], chaz_CLI *cli) {
 
     /* Register Charmonizer-specific options. */
     chaz_CLI_register(cli, "enable-c", "generate charmony.h", CHAZ_CLI_NO_ARG);
+    chaz_CLI_register(cli, "split-charmony", "write per-module headers under charmony/", CHAZ_CLI_NO_ARG);
     chaz_CLI_register(cli, "enable-perl", "generate Charmony.pm", CHAZ_CLI_NO_ARG);
     chaz_CLI_register(cli, "enable-python", "generate charmony.py", CHAZ_CLI_NO_ARG);
     chaz_CLI_register(cli, "enable-ruby", "generate charmony.rb", CHAZ_CLI_NO_ARG);
+    chaz_CLI_register(cli, "embed-build-env", "record compiler and flags in config files", CHAZ_CLI_NO_ARG);
     chaz_CLI_register(cli, "enable-makefile", NULL, CHAZ_CLI_NO_ARG);
     chaz_CLI_register(cli, "enable-coverage", NULL, CHAZ_CLI_NO_ARG);
+    chaz_CLI_register(cli, "enable-ninja", "also generate build.ninja", CHAZ_CLI_NO_ARG);
     chaz_CLI_register(cli, "cc", "compiler command", CHAZ_CLI_ARG_REQUIRED);
     chaz_CLI_register(cli, "cflags", NULL, CHAZ_CLI_ARG_OPTIONAL);
     chaz_CLI_register(cli, "make", "make command", CHAZ_CLI_ARG_OPTIONAL);
+    chaz_CLI_register(cli, "builddir", "directory for build output", CHAZ_CLI_ARG_OPTIONAL);
+    chaz_CLI_register(cli, "compiler-launcher", "compiler launcher like ccache or 'auto'", CHAZ_CLI_ARG_OPTIONAL);
+    chaz_CLI_register(cli, "build-variants", "add debug, release and profile targets", CHAZ_CLI_NO_ARG);
+    chaz_CLI_register(cli, "build-timing", "log compile and link times of the build", CHAZ_CLI_NO_ARG);
     chaz_CLI_register(cli, "prefix", "install prefix", CHAZ_CLI_ARG_OPTIONAL);
     chaz_CLI_register(cli, "bindir", "install dir for executables", CHAZ_CLI_ARG_OPTIONAL);
     chaz_CLI_register(cli, "datarootdir", "root install dir for data files", CHAZ_CLI_ARG_OPTIONAL);
     chaz_CLI_register(cli, "datadir", "install dir for data files", CHAZ_CLI_ARG_OPTIONAL);
     chaz_CLI_register(cli, "libdir", "install dir for libraries", CHAZ_CLI_ARG_OPTIONAL);
     chaz_CLI_register(cli, "mandir", "install dir for man pages", CHAZ_CLI_ARG_OPTIONAL);
+    chaz_CLI_register(cli, "probe-timeout", "timeout for probe programs in seconds", CHAZ_CLI_ARG_OPTIONAL);
+    chaz_CLI_register(cli, "probe-mem-limit", "memory limit for probe programs in MB", CHAZ_CLI_ARG_OPTIONAL);
+    chaz_CLI_register(cli, "probe-profile", "file with recorded probe results", CHAZ_CLI_ARG_OPTIONAL);
 
     /* Parse options, exiting on failure. */
     if (!chaz_CLI_parse(cli, argc, argv)) {
@@ -136,14 +150,35 @@ chaz_Probe_init(struct chaz_CLI *cli) {
 
     /* Dispatch other initializers. */
     chaz_OS_init();
+    {
+        /* Bound the run time of probe programs. */
+        long timeout   = CHAZ_PROBE_DEFAULT_TIMEOUT;
+        long mem_limit = 0;
+        if (chaz_CLI_defined(cli, "probe-timeout")) {
+            timeout = chaz_CLI_longval(cli, "probe-timeout");
+        }
+        if (chaz_CLI_defined(cli, "probe-mem-limit")) {
+            mem_limit = chaz_CLI_longval(cli, "probe-mem-limit");
+        }
+        chaz_OS_set_run_limits(timeout, mem_limit);
+    }
     chaz_CC_init(chaz_CLI_strval(cli, "cc"), chaz_CLI_strval(cli, "cflags"));
+    if (chaz_CLI_defined(cli, "probe-profile")) {
+        chaz_ProbeProfile_init(chaz_CLI_strval(cli, "probe-profile"));
+    }
     chaz_ConfWriter_init();
+    if (chaz_CLI_defined(cli, "embed-build-env")) {
+        chaz_ConfWriter_allow_host_info(true);
+    }
     chaz_HeadCheck_init();
     chaz_Make_init(cli);
 
     /* Enable output. */
     if (chaz_CLI_defined(cli, "enable-c")) {
         chaz_ConfWriterC_enable();
+        if (chaz_CLI_defined(cli, "split-charmony")) {
+            chaz_ConfWriterC_split_modules();
+        }
         output_enabled = true;
     }
     if (chaz_CLI_defined(cli, "enable-perl")) {
@@ -172,6 +207,7 @@ chaz_Probe_clean_up(void) {
 
     /* Dispatch various clean up routines. */
     chaz_ConfWriter_clean_up();
+    chaz_ProbeProfile_clean_up();
     chaz_CC_clean_up();
     chaz_Make_clean_up();
 
@@ -27,9 +27,12 @@ chaz_BuildEnv_run(void) {
 
     chaz_ConfWriter_start_module("BuildEnv");
 
-    chaz_ConfWriter_add_def("CC", chaz_CC_get_cc());
-    chaz_ConfWriter_add_def("CFLAGS", chaz_CC_get_cflags());
-    chaz_ConfWriter_add_def("EXTRA_CFLAGS", extra_cflags_string);
+    /* Compiler spellings differ between otherwise identical hosts. */
+    if (chaz_ConfWriter_host_info_allowed()) {
+        chaz_ConfWriter_add_def("CC", chaz_CC_get_cc());
+        chaz_ConfWriter_add_def("CFLAGS", chaz_CC_get_cflags());
+        chaz_ConfWriter_add_def("EXTRA_CFLAGS", extra_cflags_string);
+    }
 
     chaz_ConfWriter_end_module();
 }
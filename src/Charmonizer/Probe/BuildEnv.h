@@ -19,7 +19,8 @@
  * Capture various information about the build environment, including the C
  * compiler's interface, the shell, the operating system, etc.
  *
- * The following symbols will be defined:
+ * The following symbols will be defined if host information is allowed
+ * (see chaz_ConfWriter_allow_host_info or --embed-build-env):
  *
  * CC - String representation of the C compiler executable.
  * CFLAGS - C compiler flags.
@@ -121,8 +121,7 @@ void
 chaz_DirManip_run(void) {
     int has_dirent_h = chaz_HeadCheck_check_header("dirent.h");
     int has_direct_h = chaz_HeadCheck_check_header("direct.h");
-    int has_dirent_d_namlen = false;
-    int has_dirent_d_type   = false;
+    chaz_HeadCheckMember dirent_members[3];
 
     chaz_ConfWriter_start_module("DirManip");
     chaz_DirManip_try_mkdir();
@@ -138,18 +137,17 @@ chaz_DirManip_run(void) {
 
     /* Check for members in struct dirent. */
     if (has_dirent_h) {
-        has_dirent_d_namlen = chaz_HeadCheck_contains_member(
-                                  "struct dirent", "d_namlen",
-                                  "#include <sys/types.h>\n#include <dirent.h>"
-                              );
-        if (has_dirent_d_namlen) {
+        dirent_members[0].struct_name = "struct dirent";
+        dirent_members[0].member      = "d_namlen";
+        dirent_members[1].struct_name = "struct dirent";
+        dirent_members[1].member      = "d_type";
+        dirent_members[2].struct_name = NULL;
+        chaz_HeadCheck_contains_members(dirent_members,
+            "#include <sys/types.h>\n#include <dirent.h>");
+        if (dirent_members[0].exists) {
             chaz_ConfWriter_add_def("HAS_DIRENT_D_NAMLEN", NULL);
         }
-        has_dirent_d_type = chaz_HeadCheck_contains_member(
-                                "struct dirent", "d_type",
-                                "#include <sys/types.h>\n#include <dirent.h>"
-                            );
-        if (has_dirent_d_type) {
+        if (dirent_members[1].exists) {
             chaz_ConfWriter_add_def("HAS_DIRENT_D_TYPE", NULL);
         }
     }
@@ -76,6 +76,7 @@ void
 chaz_LargeFiles_run(void) {
     int found_off64_t = false;
     const char *stat_includes = "#include <stdio.h>\n#include <sys/stat.h>";
+    chaz_HeadCheckMember stat_members[3];
 
     chaz_ConfWriter_start_module("LargeFiles");
 
@@ -104,10 +105,16 @@ chaz_LargeFiles_run(void) {
     if (chaz_HeadCheck_check_header("fcntl.h")) {
         chaz_ConfWriter_append_conf("#define CHAZ_HAS_FCNTL_H\n");
     }
-    if (chaz_HeadCheck_contains_member("struct stat", "st_size", stat_includes)) {
+    stat_members[0].struct_name = "struct stat";
+    stat_members[0].member      = "st_size";
+    stat_members[1].struct_name = "struct stat";
+    stat_members[1].member      = "st_blocks";
+    stat_members[2].struct_name = NULL;
+    chaz_HeadCheck_contains_members(stat_members, stat_includes);
+    if (stat_members[0].exists) {
         chaz_ConfWriter_append_conf("#define CHAZ_HAS_STAT_ST_SIZE\n");
     }
-    if (chaz_HeadCheck_contains_member("struct stat", "st_blocks", stat_includes)) {
+    if (stat_members[1].exists) {
         chaz_ConfWriter_append_conf("#define CHAZ_HAS_STAT_ST_BLOCKS\n");
     }
 
@@ -154,10 +154,30 @@ S_run_tests(void) {
 #else
     FAIL("stdio.h should have been detected");
 #endif
+
+#ifdef CHY_CONFIG_HASH
+    PASS("CONFIG_HASH is defined");
+  #if CHY_CONFIG_HASH <= 0xFFFFFFFF
+    PASS("CONFIG_HASH is a 32-bit value");
+  #else
+    FAIL("CONFIG_HASH is a 32-bit value");
+  #endif
+#else
+    FAIL("CONFIG_HASH is defined");
+    SKIP("CONFIG_HASH is a 32-bit value");
+#endif
+
+    /* The hash is only stable across hosts if the compiler command isn't
+     * recorded, which requires --embed-build-env. */
+#if defined(CHY_CC) || defined(CHY_CFLAGS) || defined(CHY_EXTRA_CFLAGS)
+    FAIL("Build environment isn't embedded by default");
+#else
+    PASS("Build environment isn't embedded by default");
+#endif
 }
 
 int main(int argc, char **argv) {
-    Test_start(2);
+    Test_start(5);
     S_run_tests();
     return !Test_finish();
 }
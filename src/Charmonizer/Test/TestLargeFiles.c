@@ -82,6 +82,26 @@ S_run_tests(void) {
 
     LONG_EQ(sizeof(off64_t), 8, "off64_t type has 8 bytes");
 
+    /* The stat members are detected with a single batched probe. */
+#ifdef CHAZ_HAS_SYS_STAT_H
+  #ifdef CHAZ_HAS_STAT_ST_SIZE
+    PASS("struct stat has st_size");
+  #else
+    FAIL("struct stat has st_size");
+  #endif
+#else
+    SKIP("No sys/stat.h");
+#endif
+#if defined(CHAZ_HAS_SYS_STAT_H) && defined(CHY_HAS_UNISTD_H)
+  #ifdef CHAZ_HAS_STAT_ST_BLOCKS
+    PASS("struct stat has st_blocks on POSIX");
+  #else
+    FAIL("struct stat has st_blocks on POSIX");
+  #endif
+#else
+    SKIP("Not a POSIX system");
+#endif
+
 #ifndef HAS_64BIT_STDIO
     SKIP_REMAINING("No stdio large file support");
     return;
@@ -274,7 +294,7 @@ S_can_create_big_files(void) {
 #endif /* STAT_TESTS_ENABLED */
 
 int main(int argc, char **argv) {
-    Test_start(20);
+    Test_start(22);
     S_run_tests();
     return !Test_finish();
 }